@@ -0,0 +1,549 @@
+/*
+	Benchmarks for the libssimx kernels.
+
+	Licensed under the Apache License, Version 2.0; see ssimx/libssimx.cpp for the full notice.
+
+	Each benchmark times the current kernel against the straightforward OpenCV formulation it
+	replaced, on synthetic data, and checks that both give the same result (the blur one reports
+	how far apart they are; the downsample one requires them to be identical). The threads benchmark
+	instead times a whole comparison at increasing thread counts and checks the score doesn't move,
+	and the chroma and blurs ones report how much Options::subsampledChroma and the box blur move
+	scores, on a corpus. The incremental one times Incremental::update against scoring the whole
+	image again, for square changes of growing size, and checks both give the same score. The
+	workspace one counts the buffer allocations of consecutive comparisons with and without a
+	Workspace.
+*/
+
+#include "../ssimx/kernels.h"
+#include "../ssimx/ssimx.h"
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <chrono>
+#include <set>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+using namespace cv;
+using namespace ssimx;
+
+// Best of a few runs, in milliseconds
+template <typename F>
+static double timeit(F f, int runs = 3) {
+	double best = 1e300;
+	for (int i = 0; i < runs; i++) {
+		auto start = chrono::steady_clock::now();
+		f();
+		best = min(best, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+	}
+	return best;
+}
+
+// The grid detector as it used to be: a ROI mean per row and column, percentiles from a multiset
+static void gridMultiset(const Mat& errormap, double* worstRow, double* worstCol) {
+	unsigned int nChan = errormap.channels();
+	multiset<double> row_scores[4];
+	for (int y = 0; y < errormap.rows; y++) {
+		Mat roi = errormap(Rect(0, y, errormap.cols, 1));
+		Scalar ravg = mean(roi);
+		for (unsigned int i = 0; i < nChan; i++) row_scores[i].insert(ravg[i]);
+	}
+	for (unsigned int i = 0; i < nChan; i++) {
+		int k = 0; for (const double& s : row_scores[i]) { if (k++ >= errormap.rows / 50) { worstRow[i] = s; break; } }
+	}
+	multiset<double> col_scores[4];
+	for (int x = 0; x < errormap.cols; x++) {
+		Mat roi = errormap(Rect(x, 0, 1, errormap.rows));
+		Scalar cavg = mean(roi);
+		for (unsigned int i = 0; i < nChan; i++) col_scores[i].insert(cavg[i]);
+	}
+	for (unsigned int i = 0; i < nChan; i++) {
+		int k = 0; for (const double& s : col_scores[i]) { if (k++ >= errormap.cols / 50) { worstCol[i] = s; break; } }
+	}
+}
+
+static int benchGrid(int argc, char** argv) {
+	int width = argc > 0 ? atoi(argv[0]) : 8000, height = argc > 1 ? atoi(argv[1]) : 6000;
+	if (width < 8 || height < 8) {
+		fprintf(stderr, "grid: bad size\n");
+		return 1;
+	}
+	Mat map(height, width, CV_64FC4);
+	randu(map, Scalar::all(0), Scalar::all(1));
+
+	double rowA[4], colA[4], rowB[4], colB[4];
+	double before = timeit([&] { gridMultiset(map, rowA, colA); }, 1);
+	double after = timeit([&] {
+		LineSums lines;
+		lineSums(map, lines);
+		worstLines(lines, width, height, 4, rowB, colB);
+	});
+
+	double diff = 0;
+	for (int i = 0; i < 4; i++) diff = max(diff, max(fabs(rowA[i] - rowB[i]), fabs(colA[i] - colB[i])));
+	printf("grid %dx%d, 4 channels: multiset %.1f ms, line sums %.1f ms, %.1fx faster, max difference %g\n",
+		width, height, before, after, before / after, diff);
+	return 0;
+}
+
+// The blur of one plane against GaussianBlur, at the six scales of an image of the given size, in double and single
+// precision
+static int benchBlur(int argc, char** argv) {
+	int width = argc > 0 ? atoi(argv[0]) : 4000, height = argc > 1 ? atoi(argv[1]) : 3000;
+	if (width < 8 || height < 8) {
+		fprintf(stderr, "blur: bad size\n");
+		return 1;
+	}
+	for (int depth : { CV_64F, CV_32F }) {
+		Size size(width, height);
+		for (int scale = 0; scale < 6 && size.width >= 8 && size.height >= 8; scale++) {
+			Planes plane(1, Mat(size, depth)), blurred, boxed;
+			randu(plane[0], Scalar::all(0), Scalar::all(1));
+			Mat expected;
+			double before = timeit([&] { GaussianBlur(plane[0], expected, Size(11, 11), 1.5); });
+			double after = timeit([&] { blurScales(&plane, 1, Blur::Gaussian, &blurred, nullptr); });
+			double box = timeit([&] { blurScales(&plane, 1, Blur::Box, &boxed, nullptr); });
+			Mat diff;
+			absdiff(expected, blurred[0], diff);
+			double maxDiff = 0;
+			minMaxLoc(diff, nullptr, &maxDiff);
+			printf("%s %5dx%-5d GaussianBlur %7.2f ms, blurScales %7.2f ms, %.2fx, max difference %g; box %7.2f ms, %.2fx\n",
+				depth == CV_64F ? "double" : "float ", size.width, size.height, before, after, before / after, maxDiff, box, after / box);
+			size = Size(cvRound(size.width * 0.5), cvRound(size.height * 0.5));
+		}
+	}
+	return 0;
+}
+
+// Halving a plane against resize(0.5, INTER_AREA), from each of the six scales of an image of the given size, in double
+// and single precision
+static int benchDownsample(int argc, char** argv) {
+	int width = argc > 0 ? atoi(argv[0]) : 4000, height = argc > 1 ? atoi(argv[1]) : 3000;
+	if (width < 8 || height < 8) {
+		fprintf(stderr, "downsample: bad size\n");
+		return 1;
+	}
+	bool identical = true;
+	for (int depth : { CV_64F, CV_32F }) {
+		Size size(width, height);
+		for (int scale = 0; scale < 6 && size.width >= 8 && size.height >= 8; scale++) {
+			Planes plane(1, Mat(size, depth)), half;
+			randu(plane[0], Scalar::all(0), Scalar::all(1));
+			Mat expected, diff;
+			double before = timeit([&] { resize(plane[0], expected, Size(), 0.5, 0.5, INTER_AREA); });
+			double after = timeit([&] { downsample(plane, half, nullptr); });
+			double maxDiff = 0;
+			if (half[0].size() == expected.size()) {
+				absdiff(expected, half[0], diff);
+				minMaxLoc(diff, nullptr, &maxDiff);
+			}
+			else maxDiff = 1e300;
+			identical = identical && maxDiff == 0;
+			printf("%s %5dx%-5d resize %7.2f ms, downsample %7.2f ms, %.2fx, max difference %g\n", depth == CV_64F ? "double" : "float ",
+				size.width, size.height, before, after, before / after, maxDiff);
+			size = expected.size();
+		}
+	}
+	return identical ? 0 : 1;
+}
+
+// A random original and a slightly blurred copy of it
+static void syntheticPair(int width, int height, Mat& original, Mat& distorted) {
+	original.create(height, width, CV_8UC3);
+	randu(original, Scalar::all(0), Scalar::all(256));
+	GaussianBlur(original, distorted, Size(3, 3), 0);
+}
+
+static int benchThreads(int argc, char** argv) {
+	int width = argc > 0 ? atoi(argv[0]) : 4000, height = argc > 1 ? atoi(argv[1]) : 3000;
+	if (width < 8 || height < 8) {
+		fprintf(stderr, "threads: bad size\n");
+		return 1;
+	}
+	Mat original, distorted;
+	syntheticPair(width, height, original, distorted);
+
+	const int cpus = getNumberOfCPUs();
+	double single = 0, first = 0;
+	bool identical = true;
+	for (int threads = 1; ; threads = min(threads * 2, cpus)) {
+		setNumThreads(threads);
+		double score = 0;
+		double t = timeit([&] {
+			Reference ref;
+			if (ref.create(original) != Status::Ok || ref.score(distorted, score) != Status::Ok) exit(1);
+		});
+		if (threads == 1) single = t, first = score;
+		identical = identical && score == first;
+		printf("%dx%d, %2d threads: %.1f ms, %.2fx, score %.17g\n", width, height, threads, t, single / t, score);
+		if (threads == cpus) break;
+	}
+	setNumThreads(-1);
+	printf("scores %s\n", identical ? "identical" : "DIFFER");
+	return identical ? 0 : 1;
+}
+
+// Weights of the first channel (gray or L), from libssimx.cpp
+static const double grayScaleWeights[6] = { 0.0448, 0.2856, 0.3001, 0.2363, 0.1333, 0.1 };
+static const double grayMscaleWeights[6] = { 0.2, 0.3, 0.25, 0.2, 0.12, 0.05 };
+static const double grayMinWeight = 0.1, grayEdgeWeight = 1.5, grayGridWeight = 1.0;
+
+// Add the 2nd percentile worst row mean and then column mean of a map, as the grid detector did with ROI means
+static void plainGrid(const Mat& map, double& score, double& score_max) {
+	vector<double> rows, cols;
+	for (int y = 0; y < map.rows; y++) rows.push_back(mean(map(Rect(0, y, map.cols, 1)))[0]);
+	for (int x = 0; x < map.cols; x++) cols.push_back(mean(map(Rect(x, 0, 1, map.rows)))[0]);
+	nth_element(rows.begin(), rows.begin() + map.rows / 50, rows.end());
+	nth_element(cols.begin(), cols.begin() + map.cols / 50, cols.end());
+	score += grayGridWeight * rows[map.rows / 50] + grayGridWeight * cols[map.cols / 50];
+	score_max += 2 * grayGridWeight;
+}
+
+// The whole metric on a grayscale pair, with whole-image OpenCV blurs and pixel loops, to check the planar pipeline against
+static double plainGrayScore(const Mat& original, const Mat& distorted) {
+	Mat img1, img2;
+	original.convertTo(img1, CV_64F, 1 / 255.0);
+	distorted.convertTo(img2, CV_64F, 1 / 255.0);
+	double score = 0, score_max = 0;
+	for (int scale = 0; scale < 6; scale++) {
+		if (img1.cols < 8 || img1.rows < 8) break;
+		if (scale > 0) {
+			resize(img1, img1, Size(), 0.5, 0.5, INTER_AREA);
+			resize(img2, img2, Size(), 0.5, 0.5, INTER_AREA);
+			if (img1.cols < 8 || img1.rows < 8) break;
+		}
+		Mat xy(img1.size(), CV_64F), xxyy(img1.size(), CV_64F);
+		for (int y = 0; y < img1.rows; y++)
+			for (int x = 0; x < img1.cols; x++) {
+				const double a = img1.at<double>(y, x), b = img2.at<double>(y, x);
+				xy.at<double>(y, x) = a * b;
+				xxyy.at<double>(y, x) = a * a + b * b;
+			}
+		Mat mu1, mu2, sigma12, sigma_sq;
+		GaussianBlur(img1, mu1, Size(11, 11), 1.5);
+		GaussianBlur(img2, mu2, Size(11, 11), 1.5);
+		GaussianBlur(xy, sigma12, Size(11, 11), 1.5);
+		GaussianBlur(xxyy, sigma_sq, Size(11, 11), 1.5);
+
+		Mat ssim(img1.size(), CV_64F), edges(img1.size(), CV_64F);
+		for (int y = 0; y < img1.rows; y++)
+			for (int x = 0; x < img1.cols; x++) {
+				const double m1 = mu1.at<double>(y, x), m2 = mu2.at<double>(y, x);
+				const double num = (2 * m1 * m2 + C1) * (2 * sigma12.at<double>(y, x) - 2 * m1 * m2 + C2);
+				const double den = (m1 * m1 + m2 * m2 + C1) * (sigma_sq.at<double>(y, x) - m1 * m1 - m2 * m2 + C2);
+				ssim.at<double>(y, x) = num / den;
+				edges.at<double>(y, x) = 1 - max(fabs(img2.at<double>(y, x) - m2) - fabs(img1.at<double>(y, x) - m1), 0.0);
+			}
+
+		if (scale == 0) {
+			score += grayEdgeWeight * mean(edges)[0];
+			score_max += grayEdgeWeight;
+			plainGrid(edges, score, score_max);
+			plainGrid(ssim, score, score_max);
+		}
+		score += mean(ssim)[0] * grayScaleWeights[scale];
+		score_max += grayScaleWeights[scale];
+
+		Mat blocks;
+		double worst;
+		resize(ssim, blocks, Size(), 0.25, 0.25, INTER_AREA);
+		minMaxLoc(blocks, &worst);
+		score += grayMinWeight * worst * grayMscaleWeights[scale];
+		score_max += grayMinWeight * grayMscaleWeights[scale];
+	}
+	return min(max(score_max / score - 1, 0.0), 1.0);
+}
+
+// The grayscale pipeline against the plain formulation, and timed against the same image as RGB
+static int benchGray(int argc, char** argv) {
+	int width = argc > 0 ? atoi(argv[0]) : 4000, height = argc > 1 ? atoi(argv[1]) : 3000;
+	if (width < 8 || height < 8) {
+		fprintf(stderr, "gray: bad size\n");
+		return 1;
+	}
+	Mat original(height, width, CV_8UC1), distorted;
+	randu(original, Scalar::all(0), Scalar::all(256));
+	GaussianBlur(original, original, Size(5, 5), 1.5);
+	GaussianBlur(original, distorted, Size(3, 3), 0.8);
+
+	double gray = 0, rgb = 0;
+	double plain = 0;
+	double plainTime = timeit([&] { plain = plainGrayScore(original, distorted); }, 1);
+	double grayTime = timeit([&] { if (compare(original, distorted, gray) != Status::Ok) exit(1); });
+
+	Mat original3, distorted3;
+	merge(vector<Mat>(3, original), original3);
+	merge(vector<Mat>(3, distorted), distorted3);
+	double rgbTime = timeit([&] { if (compare(original3, distorted3, rgb) != Status::Ok) exit(1); });
+
+	const double diff = fabs(gray - plain);
+	printf("gray %dx%d: plain %.1f ms, pipeline %.1f ms, %.1fx faster, score %.17g vs %.17g, difference %g\n",
+		width, height, plainTime, grayTime, plainTime / grayTime, gray, plain, diff);
+	printf("same image as RGB: %.1f ms (score %.8f), gray is %.2fx faster\n", rgbTime, rgb, rgbTime / grayTime);
+	return diff < 1e-9 ? 0 : 1;
+}
+
+// Pearson correlation of two series
+static double pearson(const vector<double>& a, const vector<double>& b) {
+	const size_t n = a.size();
+	double ma = 0, mb = 0;
+	for (size_t i = 0; i < n; i++) ma += a[i], mb += b[i];
+	ma /= n, mb /= n;
+	double ab = 0, aa = 0, bb = 0;
+	for (size_t i = 0; i < n; i++) {
+		ab += (a[i] - ma) * (b[i] - mb);
+		aa += (a[i] - ma) * (a[i] - ma);
+		bb += (b[i] - mb) * (b[i] - mb);
+	}
+	return aa > 0 && bb > 0 ? ab / sqrt(aa * bb) : 1;
+}
+
+// Ranks of a series, ties getting their average rank
+static vector<double> ranks(const vector<double>& v) {
+	vector<size_t> order(v.size());
+	for (size_t i = 0; i < order.size(); i++) order[i] = i;
+	sort(order.begin(), order.end(), [&](size_t a, size_t b) { return v[a] < v[b]; });
+	vector<double> r(v.size());
+	for (size_t i = 0; i < order.size(); ) {
+		size_t j = i;
+		while (j + 1 < order.size() && v[order[j + 1]] == v[order[i]]) j++;
+		for (size_t k = i; k <= j; k++) r[order[k]] = (i + j) / 2.0;
+		i = j + 1;
+	}
+	return r;
+}
+
+// A smooth, colorful original and a few kinds of distortion of it at two strengths: blur, noise, posterization,
+// misregistered chroma and desaturation
+static void syntheticCorpus(int width, int height, vector<Mat>& originals, vector<Mat>& distorted) {
+	Mat original(height, width, CV_8UC3);
+	for (int y = 0; y < height; y++)
+		for (int x = 0; x < width; x++)
+			for (int c = 0; c < 3; c++)
+				original.ptr<uchar>(y)[x * 3 + c] = saturate_cast<uchar>(127 + 100 * sin(x / (7.0 + 5 * c) + c) * cos(y / (11.0 + 3 * c) - c)
+					+ ((x / 32 + y / 32) % 2 ? 30 : -30));
+
+	for (int strength = 1; strength <= 2; strength++) {
+		Mat d;
+		GaussianBlur(original, d, Size(4 * strength + 1, 4 * strength + 1), strength);
+		distorted.push_back(d);
+
+		Mat noise(height, width, CV_8UC3);
+		randu(noise, Scalar::all(0), Scalar::all(8 * strength + 1));
+		d = original.clone();
+		for (int y = 0; y < height; y++)
+			for (int i = 0; i < width * 3; i++)
+				d.ptr<uchar>(y)[i] = saturate_cast<uchar>(d.ptr<uchar>(y)[i] + noise.ptr<uchar>(y)[i] - 4 * strength);
+		distorted.push_back(d);
+
+		d = original.clone();
+		for (int y = 0; y < height; y++)
+			for (int i = 0; i < width * 3; i++) d.ptr<uchar>(y)[i] = (uchar)(d.ptr<uchar>(y)[i] / (12 * strength) * (12 * strength));
+		distorted.push_back(d);
+
+		d = original.clone();
+		for (int y = 0; y < height; y++)
+			for (int x = strength; x < width; x++) {
+				d.ptr<uchar>(y)[x * 3] = original.ptr<uchar>(y)[(x - strength) * 3];
+				d.ptr<uchar>(y)[x * 3 + 2] = original.ptr<uchar>(y)[(x - strength) * 3 + 2];
+			}
+		distorted.push_back(d);
+
+		d = original.clone();
+		for (int y = 0; y < height; y++)
+			for (int x = 0; x < width; x++) {
+				uchar* p = d.ptr<uchar>(y) + x * 3;
+				const double gray = 0.114 * p[0] + 0.587 * p[1] + 0.299 * p[2];
+				for (int c = 0; c < 3; c++) p[c] = saturate_cast<uchar>(p[c] + (gray - p[c]) * 0.15 * strength);
+			}
+		distorted.push_back(d);
+	}
+	originals.assign(distorted.size(), original);
+}
+
+// The pairs of files given, or the synthetic corpus when there are none
+static bool corpus(const char* benchmark, int argc, char** argv, vector<Mat>& originals, vector<Mat>& distorted,
+	vector<string>& names) {
+	if (argc == 0) {
+		syntheticCorpus(1000, 750, originals, distorted);
+		const char* kinds[] = { "blur", "noise", "posterize", "chroma shift", "desaturate" };
+		for (size_t i = 0; i < distorted.size(); i++) names.push_back(string(kinds[i % 5]) + (i < 5 ? " 1" : " 2"));
+		return true;
+	}
+	if (argc % 2 != 0) {
+		fprintf(stderr, "%s: expected pairs of files\n", benchmark);
+		return false;
+	}
+	for (int i = 0; i < argc; i += 2) {
+		Mat o, d;
+		if (decodeFile(argv[i], o) != Status::Ok || decodeFile(argv[i + 1], d) != Status::Ok) {
+			fprintf(stderr, "%s: cannot read %s or %s\n", benchmark, argv[i], argv[i + 1]);
+			return false;
+		}
+		originals.push_back(o);
+		distorted.push_back(d);
+		names.push_back(argv[i + 1]);
+	}
+	return true;
+}
+
+// Scores with and without Options::subsampledChroma on pairs of files, or on a synthetic corpus
+static int benchChroma(int argc, char** argv) {
+	vector<Mat> originals, distorted;
+	vector<string> names;
+	if (!corpus("chroma", argc, argv, originals, distorted, names)) return 1;
+
+	Options full, subsampled;
+	subsampled.subsampledChroma = true;
+	vector<double> a, b;
+	double fullTime = 0, subsampledTime = 0, meanDelta = 0, maxDelta = 0;
+	for (size_t i = 0; i < distorted.size(); i++) {
+		double s1 = 0, s2 = 0;
+		Status status = Status::Ok;
+		fullTime += timeit([&] { status = compare(originals[i], distorted[i], s1, nullptr, full); }, 1);
+		if (status == Status::Ok) subsampledTime += timeit([&] { status = compare(originals[i], distorted[i], s2, nullptr, subsampled); }, 1);
+		if (status != Status::Ok) {
+			fprintf(stderr, "chroma: %s: %s\n", names[i].c_str(), statusString(status));
+			return 1;
+		}
+		a.push_back(s1);
+		b.push_back(s2);
+		meanDelta += fabs(s2 - s1);
+		maxDelta = max(maxDelta, fabs(s2 - s1));
+		printf("%-24s full %.8f  subsampled %.8f  delta %+.8f (%+.2f%%)\n", names[i].c_str(), s1, s2, s2 - s1,
+			s1 > 0 ? 100 * (s2 - s1) / s1 : 0.0);
+	}
+	printf("%d pairs: mean |delta| %.8f, max |delta| %.8f, Pearson %.6f, Spearman %.6f; %.1f ms full, %.1f ms subsampled, %.2fx\n",
+		(int)a.size(), meanDelta / a.size(), maxDelta, pearson(a, b), pearson(ranks(a), ranks(b)), fullTime, subsampledTime,
+		fullTime / subsampledTime);
+	return 0;
+}
+
+// Copy square patches of the distorted image into a copy of the original, one after the other across the image, and
+// rescore after each with Incremental::update and with Reference::score
+static int benchIncremental(int argc, char** argv) {
+	int width = argc > 0 ? atoi(argv[0]) : 4000, height = argc > 1 ? atoi(argv[1]) : 3000;
+	if (width < 8 || height < 8) {
+		fprintf(stderr, "incremental: bad size\n");
+		return 1;
+	}
+	Mat original, distorted;
+	syntheticPair(width, height, original, distorted);
+	Reference ref;
+	if (ref.create(original) != Status::Ok) return 1;
+
+	bool identical = true;
+	for (int side = 16; side <= min(width, height); side *= 4) {
+		Mat current = original.clone();
+		Incremental incremental;
+		double score = 0, full = 0;
+		if (incremental.start(ref, current, score) != Status::Ok) return 1;
+
+		const int steps = 8;
+		double updateTime = 0, fullTime = 0;
+		for (int i = 0; i < steps; i++) {
+			const Rect dirty((width - side) * i / steps, (height - side) * i / steps, side, side);
+			Mat patch = current(dirty);
+			distorted(dirty).copyTo(patch);
+			updateTime += timeit([&] { incremental.update(current, dirty, score); }, 1);
+			fullTime += timeit([&] { ref.score(current, full); }, 1);
+			identical = identical && score == full;
+		}
+		printf("%dx%d, %4dx%-4d changes: update %.2f ms, whole image %.1f ms, %.0fx, score %.17g\n", width, height, side, side,
+			updateTime / steps, fullTime / steps, fullTime / updateTime, score);
+	}
+	printf("scores %s\n", identical ? "identical" : "DIFFER");
+	return identical ? 0 : 1;
+}
+
+// Consecutive comparisons of one pair, as in a batch, with and without a Workspace: plane buffers asked for (each one an
+// allocation without the workspace) and actually allocated, and time
+static int benchWorkspace(int argc, char** argv) {
+	int width = argc > 0 ? atoi(argv[0]) : 2000, height = argc > 1 ? atoi(argv[1]) : 1500, count = argc > 2 ? atoi(argv[2]) : 8;
+	if (width < 8 || height < 8 || count < 1) {
+		fprintf(stderr, "workspace: bad size\n");
+		return 1;
+	}
+	Mat original, distorted;
+	syntheticPair(width, height, original, distorted);
+
+	bool identical = true;
+	for (bool hugePages : { false, true }) {
+		Workspace workspace(hugePages);
+		Options plain, pooled;
+		pooled.workspace = &workspace;
+		double expected = 0, score = 0;
+		double before = timeit([&] { for (int i = 0; i < count; i++) compare(original, distorted, expected, nullptr, plain); }, 1);
+		double after = timeit([&] { for (int i = 0; i < count; i++) compare(original, distorted, score, nullptr, pooled); }, 1);
+		identical = identical && score == expected;
+		printf("%d comparisons of %dx%d%s: %zu allocations without a workspace, %zu with (%.1f MB kept); %.1f ms, %.1f ms, %.2fx\n",
+			count, width, height, hugePages ? ", huge pages" : "", workspace.requests(), workspace.allocations(),
+			workspace.bytes() / 1048576.0, before, after, before / after);
+	}
+	printf("scores %s\n", identical ? "identical" : "DIFFER");
+	return identical ? 0 : 1;
+}
+
+// Throughput of every Options::blur, and how its scores correlate with exact ones, on pairs of files or on a synthetic
+// corpus
+static int benchBlurs(int argc, char** argv) {
+	vector<Mat> originals, distorted;
+	vector<string> names;
+	if (!corpus("blurs", argc, argv, originals, distorted, names)) return 1;
+
+	const Blur blurs[] = { Blur::Gaussian, Blur::Box };
+	const char* blurNames[] = { "gaussian", "box" };
+	vector<double> scores[2];
+	double time[2] = {}, pixels = 0;
+	for (size_t i = 0; i < distorted.size(); i++) {
+		pixels += (double)originals[i].total();
+		for (int b = 0; b < 2; b++) {
+			Options options;
+			options.blur = blurs[b];
+			double score = 0;
+			Status status = Status::Ok;
+			time[b] += timeit([&] { status = compare(originals[i], distorted[i], score, nullptr, options); }, 1);
+			if (status != Status::Ok) {
+				fprintf(stderr, "blurs: %s: %s\n", names[i].c_str(), statusString(status));
+				return 1;
+			}
+			scores[b].push_back(score);
+		}
+		printf("%-24s gaussian %.8f  box %.8f\n", names[i].c_str(), scores[0][i], scores[1][i]);
+	}
+	for (int b = 0; b < 2; b++) {
+		double meanDelta = 0;
+		for (size_t i = 0; i < distorted.size(); i++) meanDelta += fabs(scores[b][i] - scores[0][i]);
+		printf("%-9s %6.1f Mpixel/s, %.2fx; mean |delta| %.8f, Pearson %.6f, Spearman %.6f\n", blurNames[b], pixels / time[b] / 1000,
+			time[0] / time[b], meanDelta / distorted.size(), pearson(scores[0], scores[b]), pearson(ranks(scores[0]), ranks(scores[b])));
+	}
+	return 0;
+}
+
+static const struct {
+	const char* name;
+	const char* args;
+	int (*run)(int argc, char** argv);
+} benchmarks[] = {
+	{ "grid", "[width height]", benchGrid },
+	{ "blur", "[width height]", benchBlur },
+	{ "downsample", "[width height]", benchDownsample },
+	{ "threads", "[width height]", benchThreads },
+	{ "gray", "[width height]", benchGray },
+	{ "chroma", "[original distorted ...]", benchChroma },
+	{ "blurs", "[original distorted ...]", benchBlurs },
+	{ "incremental", "[width height]", benchIncremental },
+	{ "workspace", "[width height [count]]", benchWorkspace },
+};
+
+int main(int argc, char** argv) {
+	if (argc >= 2) {
+		for (const auto& b : benchmarks)
+			if (strcmp(argv[1], b.name) == 0) return b.run(argc - 2, argv + 2);
+	}
+	fprintf(stderr, "Usage: %s benchmark [args]\n", argv[0]);
+	for (const auto& b : benchmarks) fprintf(stderr, "  %s %s\n", b.name, b.args);
+	return 1;
+}
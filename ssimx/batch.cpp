@@ -0,0 +1,515 @@
+/*
+	Batch mode of the command line tool: many pairs scored in one process.
+
+	Licensed under the Apache License, Version 2.0; see libssimx.cpp for the full notice.
+
+	Pairs come from a manifest or from two directory trees. A manifest has one pair per line, as
+	CSV (original,distorted; a tab instead of the comma works too, quoted fields may hold either,
+	and a header line naming the two columns is skipped) or as a JSON object with "original" and
+	"distorted" members. Read from stdin, it can be fed while the batch runs. With two trees, every
+	file under the first is paired with the file at the same relative path under the second.
+
+	Worker threads take the next pairs in turn, each with its own Workspace, so pairs of the same
+	size as the one before allocate no planes; a worker releases its free planes when the size of
+	its originals changes. Consecutive lines of a manifest file with the same original go to one
+	worker, which decodes and precomputes that original once. Input is read by one worker at a
+	time without holding up the output, so a driver can write a pair to stdin and wait for its
+	result. Every pair gets one JSON line, in input order, with its score or the reason it has
+	none; a pair that cannot be read, decoded or compared does not stop the others.
+*/
+
+#include "batch.h"
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace cv;
+namespace fs = std::filesystem;
+
+// most pairs of one original handed to a worker at once
+static const size_t GROUP = 8;
+
+struct Pair {
+	string original, distorted;
+	string error;   // why the input gave no pair
+	size_t index = 0;
+};
+
+struct Record {
+	string line;
+	bool failed;
+};
+
+// Stores the next pair of the input; false at the end
+typedef function<bool(Pair&)> PairSource;
+
+// A line without its end of line; false at the end of the file
+static bool readLine(FILE* file, string& line) {
+	line.clear();
+	char buffer[4096];
+	bool read = false;
+	while (fgets(buffer, sizeof buffer, file)) {
+		read = true;
+		line += buffer;
+		if (!line.empty() && line.back() == '\n') break;
+	}
+	while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) line.pop_back();
+	return read;
+}
+
+// The fields of a CSV line, separated by whichever of a comma or a tab comes first outside quotes
+static bool csvFields(const string& line, vector<string>& fields) {
+	char separator = ',';
+	bool quoted = false;
+	for (const char c : line) {
+		if (c == '"') quoted = !quoted;
+		else if (!quoted && (c == ',' || c == '\t')) {
+			separator = c;
+			break;
+		}
+	}
+	fields.assign(1, string());
+	quoted = false;
+	for (size_t i = 0; i < line.size(); i++) {
+		const char c = line[i];
+		if (quoted) {
+			if (c != '"') fields.back() += c;
+			else if (i + 1 < line.size() && line[i + 1] == '"') { fields.back() += '"'; i++; }
+			else quoted = false;
+		}
+		else if (c == '"') quoted = true;
+		else if (c == separator) fields.emplace_back();
+		else fields.back() += c;
+	}
+	return !quoted;
+}
+
+static void appendUtf8(string& s, unsigned code) {
+	if (code < 0x80) s += (char)code;
+	else if (code < 0x800) {
+		s += (char)(0xC0 | code >> 6);
+		s += (char)(0x80 | (code & 0x3F));
+	}
+	else if (code < 0x10000) {
+		s += (char)(0xE0 | code >> 12);
+		s += (char)(0x80 | (code >> 6 & 0x3F));
+		s += (char)(0x80 | (code & 0x3F));
+	}
+	else {
+		s += (char)(0xF0 | code >> 18);
+		s += (char)(0x80 | (code >> 12 & 0x3F));
+		s += (char)(0x80 | (code >> 6 & 0x3F));
+		s += (char)(0x80 | (code & 0x3F));
+	}
+}
+
+static bool hex4(const string& text, size_t i, unsigned& code) {
+	if (i + 4 > text.size()) return false;
+	code = 0;
+	for (size_t k = i; k < i + 4; k++) {
+		const char c = text[k];
+		code <<= 4;
+		if (c >= '0' && c <= '9') code |= c - '0';
+		else if (c >= 'a' && c <= 'f') code |= c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F') code |= c - 'A' + 10;
+		else return false;
+	}
+	return true;
+}
+
+// The JSON string starting at text[i], which is past it on return
+static bool jsonString(const string& text, size_t& i, string& value) {
+	if (i >= text.size() || text[i] != '"') return false;
+	value.clear();
+	for (i++; i < text.size(); i++) {
+		const char c = text[i];
+		if (c == '"') {
+			i++;
+			return true;
+		}
+		if (c != '\\') {
+			value += c;
+			continue;
+		}
+		if (++i == text.size()) return false;
+		unsigned code;
+		switch (text[i]) {
+		case '"': value += '"'; break;
+		case '\\': value += '\\'; break;
+		case '/': value += '/'; break;
+		case 'b': value += '\b'; break;
+		case 'f': value += '\f'; break;
+		case 'n': value += '\n'; break;
+		case 'r': value += '\r'; break;
+		case 't': value += '\t'; break;
+		case 'u':
+			if (!hex4(text, i + 1, code)) return false;
+			i += 4;
+			// a surrogate pair
+			if (code >= 0xD800 && code < 0xDC00) {
+				unsigned low;
+				if (text.compare(i + 1, 2, "\\u") != 0 || !hex4(text, i + 3, low) || low < 0xDC00 || low >= 0xE000) return false;
+				code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+				i += 6;
+			}
+			appendUtf8(value, code);
+			break;
+		default: return false;
+		}
+	}
+	return false;
+}
+
+// The string members of a JSON object on one line; members of other types are skipped, nested ones are not supported
+static bool jsonMembers(const string& line, map<string, string>& members) {
+	size_t i = line.find_first_not_of(" \t");
+	if (i == string::npos || line[i] != '{') return false;
+	i++;
+	for (;;) {
+		i = line.find_first_not_of(" \t", i);
+		if (i == string::npos) return false;
+		if (line[i] == '}') return line.find_first_not_of(" \t", i + 1) == string::npos;
+		string key, value;
+		if (!jsonString(line, i, key)) return false;
+		i = line.find_first_not_of(" \t", i);
+		if (i == string::npos || line[i] != ':') return false;
+		i = line.find_first_not_of(" \t", i + 1);
+		if (i == string::npos) return false;
+		if (line[i] == '"') {
+			if (!jsonString(line, i, value)) return false;
+			members[key] = value;
+		}
+		else if (line[i] == '{' || line[i] == '[') return false;
+		else i = line.find_first_of(",}", i);
+		i = line.find_first_not_of(" \t", i);
+		if (i == string::npos) return false;
+		if (line[i] == ',') i++;
+		else if (line[i] != '}') return false;
+	}
+}
+
+// One pair per line of the file, CSV or JSON; lines that are not a pair give a Pair with an error
+static PairSource manifestSource(FILE* file) {
+	auto lineNumber = make_shared<size_t>(0);
+	return [file, lineNumber](Pair& pair) {
+		string line;
+		while (readLine(file, line)) {
+			++*lineNumber;
+			if (line.find_first_not_of(" \t") == string::npos) continue;
+			pair = Pair();
+			if (line[line.find_first_not_of(" \t")] == '{') {
+				map<string, string> members;
+				if (jsonMembers(line, members) && members.count("original") && members.count("distorted")) {
+					pair.original = members["original"];
+					pair.distorted = members["distorted"];
+					return true;
+				}
+			}
+			else {
+				vector<string> fields;
+				if (csvFields(line, fields) && fields.size() == 2) {
+					if (*lineNumber == 1 && fields[0] == "original" && fields[1] == "distorted") continue;
+					pair.original = fields[0];
+					pair.distorted = fields[1];
+					return true;
+				}
+			}
+			pair.error = "Manifest line " + to_string(*lineNumber) + " is not an original and distorted pair";
+			return true;
+		}
+		return false;
+	};
+}
+
+// Every file under originals, by relative path, with the file at the same place under distorted
+static bool directorySource(const string& originals, const string& distorted, PairSource& source) {
+	error_code error;
+	if (!fs::is_directory(originals, error)) {
+		fprintf(stderr, "Not a directory: %s\n", originals.c_str());
+		return false;
+	}
+	if (!fs::is_directory(distorted, error)) {
+		fprintf(stderr, "Not a directory: %s\n", distorted.c_str());
+		return false;
+	}
+
+	auto files = make_shared<vector<fs::path>>();
+	fs::recursive_directory_iterator it(originals, fs::directory_options::skip_permission_denied, error), end;
+	for (; !error && it != end; it.increment(error))
+		if (it->is_regular_file(error)) files->push_back(it->path().lexically_relative(originals));
+	if (error) {
+		fprintf(stderr, "%s: %s\n", error.message().c_str(), originals.c_str());
+		return false;
+	}
+	sort(files->begin(), files->end());
+
+	auto next = make_shared<size_t>(0);
+	const fs::path from(originals), to(distorted);
+	source = [files, next, from, to](Pair& pair) {
+		if (*next == files->size()) return false;
+		const fs::path& file = (*files)[(*next)++];
+		pair = Pair();
+		pair.original = (from / file).string();
+		pair.distorted = (to / file).string();
+		return true;
+	};
+	return true;
+}
+
+static void appendJson(string& out, const string& s) {
+	out += '"';
+	for (const char ch : s) {
+		const unsigned char c = (unsigned char)ch;
+		switch (c) {
+		case '"': out += "\\\""; break;
+		case '\\': out += "\\\\"; break;
+		case '\n': out += "\\n"; break;
+		case '\r': out += "\\r"; break;
+		case '\t': out += "\\t"; break;
+		default:
+			if (c < 0x20) {
+				char escaped[8];
+				snprintf(escaped, sizeof escaped, "\\u%04x", c);
+				out += escaped;
+			}
+			else out += ch;
+		}
+	}
+	out += '"';
+}
+
+// {"original": ..., "distorted": ..., "score": ..., "width": ..., "height": ..., "distorted_width": ...,
+// "distorted_height": ..., "ms": ..., "error": ...}; the score is null on error, and the size of either image is left out
+// if it could not be decoded
+static Record record(const Pair& pair, const Mat& img1, const Mat& img2, double score, double ms, const string& error) {
+	char number[64];
+	string out = "{\"original\":";
+	appendJson(out, pair.original);
+	out += ",\"distorted\":";
+	appendJson(out, pair.distorted);
+	if (error.empty()) snprintf(number, sizeof number, ",\"score\":%.8f", score);
+	else snprintf(number, sizeof number, ",\"score\":null");
+	out += number;
+	if (!img1.empty()) {
+		snprintf(number, sizeof number, ",\"width\":%i,\"height\":%i", img1.cols, img1.rows);
+		out += number;
+	}
+	if (!img2.empty()) {
+		snprintf(number, sizeof number, ",\"distorted_width\":%i,\"distorted_height\":%i", img2.cols, img2.rows);
+		out += number;
+	}
+	snprintf(number, sizeof number, ",\"ms\":%.1f", ms);
+	out += number;
+	if (!error.empty()) {
+		out += ",\"error\":";
+		appendJson(out, error);
+	}
+	out += "}\n";
+	return { out, !error.empty() };
+}
+
+static string decodeError(ssimx::Status status, const string& filename) {
+	return string(ssimx::statusString(status)) + ": " + filename;
+}
+
+static string compareError(ssimx::Status status, const Mat& img1, const Mat& img2) {
+	char detail[128] = "";
+	if (status == ssimx::Status::SizeMismatch)
+		snprintf(detail, sizeof detail, " (%ix%i and %ix%i)", img1.cols, img1.rows, img2.cols, img2.rows);
+	else if (status == ssimx::Status::ChannelMismatch)
+		snprintf(detail, sizeof detail, " (%i and %i channels)", img1.channels(), img2.channels());
+	return ssimx::statusString(status) + string(detail);
+}
+
+// Pairs with the same original, in input order: one record each. The original's decoding and precomputation count
+// in the time of the first. size is that of the last original scored with the workspace of options.
+static void scoreGroup(const vector<Pair>& group, const ssimx::Options& options, Size& size, vector<Record>& records) {
+	typedef chrono::steady_clock Clock;
+	Clock::time_point start = Clock::now();
+	const auto elapsed = [&]() {
+		const Clock::time_point now = Clock::now();
+		const double ms = chrono::duration<double, milli>(now - start).count();
+		start = now;
+		return ms;
+	};
+
+	if (!group[0].error.empty()) {
+		records.push_back(record(group[0], Mat(), Mat(), 0, 0, group[0].error));
+		return;
+	}
+
+	// under a memory limit nothing is precomputed; every comparison streams both images
+	Mat img1;
+	ssimx::Reference ref;
+	ssimx::Status status = ssimx::decodeFile(group[0].original, img1);
+	string failed = status == ssimx::Status::Ok ? string() : decodeError(status, group[0].original);
+	// the planes of another size are of no use any more
+	if (failed.empty() && img1.size() != size) {
+		options.workspace->trim();
+		size = img1.size();
+	}
+	if (failed.empty() && !options.maxMemory) {
+		status = ref.create(img1, options);
+		if (status != ssimx::Status::Ok) failed = ssimx::statusString(status);
+	}
+
+	for (const Pair& pair : group) {
+		if (!failed.empty()) {
+			records.push_back(record(pair, img1, Mat(), 0, elapsed(), failed));
+			continue;
+		}
+		Mat img2;
+		double score = 0;
+		string error;
+		status = ssimx::decodeFile(pair.distorted, img2);
+		if (status != ssimx::Status::Ok) error = decodeError(status, pair.distorted);
+		else {
+			status = options.maxMemory ? ssimx::compare(img1, img2, score, NULL, options) : ref.score(img2, score);
+			if (status != ssimx::Status::Ok) error = compareError(status, img1, img2);
+		}
+		records.push_back(record(pair, img1, img2, score, elapsed(), error));
+	}
+}
+
+struct Batch {
+	PairSource source;
+	bool grouped;       // hand out consecutive pairs of one original together
+	Pair pending;       // read but not handed out
+	bool hasPending = false;
+	mutex input;        // over the above; reading may wait for a stream, so it is not held with lock
+
+	size_t read = 0, written = 0, errors = 0;
+	size_t window;      // most records ahead of the last one written
+	map<size_t, string> done;
+	FILE* out;
+	mutex lock;         // over the above, and the output
+	condition_variable room;
+};
+
+// The next pairs to score, in input order; false at the end of the input
+static bool take(Batch& b, vector<Pair>& group) {
+	lock_guard<mutex> reading(b.input);
+	{
+		unique_lock<mutex> guard(b.lock);
+		b.room.wait(guard, [&] { return b.read - b.written < b.window; });
+	}
+	group.clear();
+	while (group.size() < (b.grouped ? GROUP : 1)) {
+		Pair pair;
+		if (b.hasPending) {
+			pair = move(b.pending);
+			b.hasPending = false;
+		}
+		else if (!b.source(pair)) break;
+		if (!group.empty() && (pair.original != group[0].original || !pair.error.empty() || !group[0].error.empty())) {
+			b.pending = move(pair);
+			b.hasPending = true;
+			break;
+		}
+		group.push_back(move(pair));
+	}
+	lock_guard<mutex> guard(b.lock);
+	for (Pair& pair : group) pair.index = b.read++;
+	return !group.empty();
+}
+
+// Writes whatever records are now next in input order
+static void put(Batch& b, const vector<Pair>& group, const vector<Record>& records) {
+	lock_guard<mutex> guard(b.lock);
+	for (size_t i = 0; i < group.size(); i++) {
+		b.done[group[i].index] = records[i].line;
+		if (records[i].failed) b.errors++;
+	}
+	bool wrote = false;
+	for (auto next = b.done.find(b.written); next != b.done.end(); next = b.done.find(b.written)) {
+		fputs(next->second.c_str(), b.out);
+		b.done.erase(next);
+		b.written++;
+		wrote = true;
+	}
+	if (wrote) {
+		fflush(b.out);
+		b.room.notify_all();
+	}
+}
+
+static void work(Batch& b, ssimx::Options options) {
+	// the planes of one comparison are reused by the next one on this thread
+	ssimx::Workspace workspace;
+	options.workspace = &workspace;
+
+	Size size;
+	vector<Pair> group;
+	vector<Record> records;
+	while (take(b, group)) {
+		records.clear();
+		try {
+			scoreGroup(group, options, size, records);
+		}
+		catch (const exception& e) {
+			records.clear();
+			for (const Pair& pair : group) records.push_back(record(pair, Mat(), Mat(), 0, 0, string("Internal error: ") + e.what()));
+		}
+		put(b, group, records);
+	}
+}
+
+int runBatch(const BatchInput& input, const ssimx::Options& options, int jobs, const string& output) {
+	Batch b;
+	FILE* manifest = NULL;
+	if (!input.manifest.empty()) {
+		manifest = input.manifest == "-" ? stdin : fopen(input.manifest.c_str(), "rb");
+		if (!manifest) {
+			fprintf(stderr, "%s: %s\n", ssimx::statusString(ssimx::Status::ReadError), input.manifest.c_str());
+			return -1;
+		}
+		b.source = manifestSource(manifest);
+		// waiting for the next line of a stream to see whether it has the same original would hold up the current one
+		b.grouped = manifest != stdin;
+	}
+	else {
+		if (!directorySource(input.originals, input.distorted, b.source)) return -1;
+		b.grouped = false;
+	}
+
+	b.out = output.empty() ? stdout : fopen(output.c_str(), "wb");
+	if (!b.out) {
+		fprintf(stderr, "Cannot open file for write: %s\n", output.c_str());
+		if (manifest && manifest != stdin) fclose(manifest);
+		return -1;
+	}
+
+	// a worker per CPU, so that decoding, which mostly runs on one thread, keeps them all busy
+	const int cpus = max(1, getNumberOfCPUs());
+	if (jobs <= 0) jobs = cpus;
+	b.window = max((size_t)1024, (size_t)jobs * 64);
+
+	// the workers share the CPUs: the threads of each comparison (and AVIF decoder) are split among them, one each by
+	// default, instead of every worker starting a thread per CPU. The setting is global, so it is put back afterwards.
+	const int threads = getNumThreads();
+	if (jobs > 1) setNumThreads(max(1, cpus / jobs));
+
+	const auto start = chrono::steady_clock::now();
+	vector<thread> workers;
+	for (int i = 0; i < jobs; i++) workers.emplace_back(work, ref(b), options);
+	for (thread& worker : workers) worker.join();
+	const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	setNumThreads(threads);
+
+	if (manifest && manifest != stdin) fclose(manifest);
+	if (b.out != stdout) fclose(b.out);
+	fprintf(stderr, "%zu pairs, %zu errors, %.1f pairs/s\n", b.written, b.errors, seconds > 0 ? b.written / seconds : 0.0);
+	return b.errors ? -1 : 0;
+}
@@ -0,0 +1,21 @@
+/*
+	Batch mode of the command line tool.
+
+	Licensed under the Apache License, Version 2.0; see libssimx.cpp for the full notice.
+*/
+
+#pragma once
+
+#include "ssimx.h"
+
+#include <string>
+
+// Where the pairs of a batch come from: a manifest (CSV or JSONL, "-" for stdin), or two directory trees
+struct BatchInput {
+	std::string manifest;
+	std::string originals, distorted;
+};
+
+// Score every pair on jobs threads (0: one per CPU), writing one JSON object per line to output (empty: stdout).
+// Returns 0, or -1 if some pair could not be scored or the input could not be read.
+int runBatch(const BatchInput& input, const ssimx::Options& options, int jobs, const std::string& output);
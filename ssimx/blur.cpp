@@ -0,0 +1,360 @@
+/*
+	Fused Gaussian blur of image moments.
+
+	Licensed under the Apache License, Version 2.0; see libssimx.cpp for the full notice.
+
+	SSIM needs the 11x11, sigma 1.5 Gaussian blur of several per-pixel products of the two images.
+	Instead of materializing each product and blurring it on its own, the products are formed
+	while a source row is loaded, filtered horizontally into a ring of the last 11 rows, and each
+	output row is filtered vertically out of that ring. The image is split into tiles whose rings
+	stay in cache; tiles are independent and run in parallel, those of all planes and scales of a
+	pyramid together. Every output value is computed the same way whatever the tiling, so results
+	don't depend on the number of threads.
+
+	The taps are built in, and both passes fold them around the centre: the pixels at the same
+	distance on either side are added before being multiplied by their shared tap, 6 products per
+	output instead of 11, summed from the outermost taps in. The AVX2 and AVX-512 versions do the
+	same additions and products in the same order, without FMA, so they give the same values as the
+	portable one; kernels.h keeps GCC and Clang from fusing them on their own.
+
+	The box tier (Options::blur) replaces the Gaussian along each axis with three box filters of
+	width 3: (1 3 6 7 6 3 1) / 27, sigma 1.41, the closest odd widths get to 1.5. Down the columns each
+	box is a running sum over a whole row at a time: the next row is added, the one leaving the
+	window subtracted, a cost that does not depend on the width. Along a row a running sum would be
+	one serial chain, so there each box adds its three neighbours directly, which at width 3 is the
+	same two additions, a vector at a time. The running sums restart from a direct sum every 16 rows,
+	counted from the first row of the tile, and all tiles start at multiples of 16 rows of their
+	scale (blurScales' 128 row bands, the 128x64 scoring tiles, the streaming bands), so every value
+	is again the same whatever the tiling, and the original's blur is made once, as for the Gaussian.
+*/
+
+#include "kernels.h"
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <vector>
+#ifdef SSIMX_X86
+#include <immintrin.h>
+#endif
+
+using namespace std;
+using namespace cv;
+
+namespace ssimx {
+
+static const int RADIUS = 5, TAPS = 2 * RADIUS + 1;
+
+// keep the rings of a tile (TAPS rows per moment) around 256 KB
+static const size_t RING_BYTES = 256 * 1024;
+static const int BAND_ROWS = 128;
+
+// BORDER_REFLECT_101, the GaussianBlur default
+static inline int reflect101(int i, int n) {
+	if (n == 1) return 0;
+	while (i < 0 || i >= n) i = i < 0 ? -i : 2 * n - 2 - i;
+	return i;
+}
+
+// One source row of a moment, over the padded columns of a tile
+template <typename T>
+static void loadMoment(Moment moment, const T* x, const T* y, const int* offset, int n, T* line) {
+	switch (moment) {
+	case Moment::X: for (int j = 0; j < n; j++) line[j] = x[offset[j]]; break;
+	case Moment::Y: for (int j = 0; j < n; j++) line[j] = y[offset[j]]; break;
+	case Moment::XY: for (int j = 0; j < n; j++) line[j] = x[offset[j]] * y[offset[j]]; break;
+	case Moment::XXYY: for (int j = 0; j < n; j++) line[j] = x[offset[j]] * x[offset[j]] + y[offset[j]] * y[offset[j]]; break;
+	}
+}
+
+// Taps 0 to 5 of the 11 tap, sigma 1.5 Gaussian, as getGaussianKernel(11, 1.5, CV_64F) makes them: exp(-x^2 / 4.5)
+// normalized in double precision; taps 6 to 10 mirror them
+static const double GAUSSIAN[RADIUS + 1] = {
+	0.0010283800844791101, 0.0075987581352391859, 0.036000772128430829,
+	0.10936068950970003, 0.21300553771125372, 0.26601172486179436,
+};
+
+// The box blur restarts its running sums every BOX_RUN rows, and divides by 27 * 27 once at the end
+static const int BOX_RUN = 16;
+static const double BOX_SCALE = 1.0 / 729;
+
+#ifdef SSIMX_X86
+
+// One vector after the other of out = the taps times src[0..TAPS), with the given intrinsics; returns the number of
+// values done, a whole number of vectors
+#define BLUR_ROW(T, lanes, set1, loadu, storeu, mul, add) { \
+	const auto centre = set1((T)GAUSSIAN[RADIUS]); \
+	const decltype(centre) w[RADIUS] = { set1((T)GAUSSIAN[0]), set1((T)GAUSSIAN[1]), set1((T)GAUSSIAN[2]), \
+		set1((T)GAUSSIAN[3]), set1((T)GAUSSIAN[4]) }; \
+	int i = 0; \
+	for (; i + lanes <= n; i += lanes) { \
+		auto sum = mul(w[0], add(loadu(src[0] + i), loadu(src[TAPS - 1] + i))); \
+		for (int t = 1; t < RADIUS; t++) sum = add(sum, mul(w[t], add(loadu(src[t] + i), loadu(src[TAPS - 1 - t] + i)))); \
+		storeu(out + i, add(sum, mul(centre, loadu(src[RADIUS] + i)))); \
+	} \
+	return i; \
+}
+
+SSIMX_TARGET_AVX2 static int blurRowAVX2(const double* const* src, int n, double* out) {
+	BLUR_ROW(double, 4, _mm256_set1_pd, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_mul_pd, _mm256_add_pd);
+}
+
+SSIMX_TARGET_AVX2 static int blurRowAVX2(const float* const* src, int n, float* out) {
+	BLUR_ROW(float, 8, _mm256_set1_ps, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_mul_ps, _mm256_add_ps);
+}
+
+SSIMX_TARGET_AVX512 static int blurRowAVX512(const double* const* src, int n, double* out) {
+	BLUR_ROW(double, 8, _mm512_set1_pd, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_mul_pd, _mm512_add_pd);
+}
+
+SSIMX_TARGET_AVX512 static int blurRowAVX512(const float* const* src, int n, float* out) {
+	BLUR_ROW(float, 16, _mm512_set1_ps, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_mul_ps, _mm512_add_ps);
+}
+
+#endif
+
+// out[i] = the taps times src[0..TAPS)[i], folded: one pass of the blur, horizontal when the rows of src are the same
+// line shifted by one pixel, vertical when they are the rows above and below
+template <typename T>
+static void blurRow(CpuLevel level, const T* const* src, int n, T* out) {
+	int i = 0;
+#ifdef SSIMX_X86
+	if (level == CpuLevel::AVX512) i = blurRowAVX512(src, n, out);
+	else if (level == CpuLevel::AVX2) i = blurRowAVX2(src, n, out);
+#endif
+	for (; i < n; i++) {
+		T sum = (T)GAUSSIAN[0] * (src[0][i] + src[TAPS - 1][i]);
+		for (int t = 1; t < RADIUS; t++) sum += (T)GAUSSIAN[t] * (src[t][i] + src[TAPS - 1 - t][i]);
+		out[i] = sum + (T)GAUSSIAN[RADIUS] * src[RADIUS][i];
+	}
+}
+
+// Element offsets of the padded source columns of a tile
+static vector<int> paddedOffsets(const Mat& x, Rect tile) {
+	const int cn = x.channels();
+	vector<int> offset((tile.width + 2 * RADIUS) * cn);
+	for (int j = 0; j < tile.width + 2 * RADIUS; j++)
+		for (int c = 0; c < cn; c++) offset[j * cn + c] = reflect101(tile.x - RADIUS + j, x.cols) * cn + c;
+	return offset;
+}
+
+#ifdef SSIMX_X86
+
+// One vector after the other of out = a + b + c, or with last = sub, a + b - c, with the given intrinsics; returns the
+// number of values done, a whole number of vectors
+#define SUM_ROW(lanes, loadu, storeu, add, last) { \
+	int i = 0; \
+	for (; i + lanes <= n; i += lanes) storeu(out + i, last(add(loadu(a + i), loadu(b + i)), loadu(c + i))); \
+	return i; \
+}
+
+// One vector after the other of out = in times scale
+#define SCALE_ROW(lanes, set1, loadu, storeu, mul) { \
+	const auto w = set1(scale); \
+	int i = 0; \
+	for (; i + lanes <= n; i += lanes) storeu(out + i, mul(loadu(in + i), w)); \
+	return i; \
+}
+
+SSIMX_TARGET_AVX2 static int sumRowAVX2(const double* a, const double* b, const double* c, bool subtract, int n, double* out) {
+	if (subtract) SUM_ROW(4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_add_pd, _mm256_sub_pd);
+	SUM_ROW(4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_add_pd, _mm256_add_pd);
+}
+
+SSIMX_TARGET_AVX2 static int sumRowAVX2(const float* a, const float* b, const float* c, bool subtract, int n, float* out) {
+	if (subtract) SUM_ROW(8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_add_ps, _mm256_sub_ps);
+	SUM_ROW(8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_add_ps, _mm256_add_ps);
+}
+
+SSIMX_TARGET_AVX512 static int sumRowAVX512(const double* a, const double* b, const double* c, bool subtract, int n, double* out) {
+	if (subtract) SUM_ROW(8, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_add_pd, _mm512_sub_pd);
+	SUM_ROW(8, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_add_pd, _mm512_add_pd);
+}
+
+SSIMX_TARGET_AVX512 static int sumRowAVX512(const float* a, const float* b, const float* c, bool subtract, int n, float* out) {
+	if (subtract) SUM_ROW(16, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_add_ps, _mm512_sub_ps);
+	SUM_ROW(16, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_add_ps, _mm512_add_ps);
+}
+
+SSIMX_TARGET_AVX2 static int scaleRowAVX2(const double* in, double scale, int n, double* out) {
+	SCALE_ROW(4, _mm256_set1_pd, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_mul_pd);
+}
+
+SSIMX_TARGET_AVX2 static int scaleRowAVX2(const float* in, float scale, int n, float* out) {
+	SCALE_ROW(8, _mm256_set1_ps, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_mul_ps);
+}
+
+SSIMX_TARGET_AVX512 static int scaleRowAVX512(const double* in, double scale, int n, double* out) {
+	SCALE_ROW(8, _mm512_set1_pd, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_mul_pd);
+}
+
+SSIMX_TARGET_AVX512 static int scaleRowAVX512(const float* in, float scale, int n, float* out) {
+	SCALE_ROW(16, _mm512_set1_ps, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_mul_ps);
+}
+
+#endif
+
+// out[i] = a[i] + b[i] + c[i], or a[i] + b[i] - c[i] when subtracting, added in that order
+template <typename T>
+static void sumRow(CpuLevel level, const T* a, const T* b, const T* c, bool subtract, int n, T* out) {
+	int i = 0;
+#ifdef SSIMX_X86
+	if (level == CpuLevel::AVX512) i = sumRowAVX512(a, b, c, subtract, n, out);
+	else if (level == CpuLevel::AVX2) i = sumRowAVX2(a, b, c, subtract, n, out);
+#endif
+	if (subtract) for (; i < n; i++) out[i] = a[i] + b[i] - c[i];
+	else for (; i < n; i++) out[i] = a[i] + b[i] + c[i];
+}
+
+template <typename T>
+static void scaleRow(CpuLevel level, const T* in, T scale, int n, T* out) {
+	int i = 0;
+#ifdef SSIMX_X86
+	if (level == CpuLevel::AVX512) i = scaleRowAVX512(in, scale, n, out);
+	else if (level == CpuLevel::AVX2) i = scaleRowAVX2(in, scale, n, out);
+#endif
+	for (; i < n; i++) out[i] = in[i] * scale;
+}
+
+// Whether box k (1 to 3) of a column is a direct sum at row r of a tile, rather than the running sum from the row above.
+// Runs start at every BOX_RUN-th row; box k also restarts at the last 3 - k rows of every run, which include the rows
+// above a tile that the next box reads, so no running sum reaches back above the first row a tile computes.
+static inline bool boxRestarts(int k, int r) {
+	const int i = r & (BOX_RUN - 1);
+	return i == 0 || i >= BOX_RUN - (3 - k);
+}
+
+// blurTile with the box blur. Every source row is boxed three times along the row, then each of the three boxes down
+// the columns takes the row one further down: box k at row r, from the rows of box k - 1 (or of the horizontal
+// boxes), is rows r - 1, r and r + 1 added, or, running, its own row r - 1 plus row r + 1 minus row r - 2. Rows are
+// kept in rings of 4 and counted from the first row of the tile.
+template <typename T>
+static void boxTile(const Mat& x, const Mat& y, const Moment* moments, int count, Rect tile, T* const* out, size_t step) {
+	const CpuLevel level = cpuLevel();
+	const int cn = x.channels();
+	const int width = tile.width * cn, padded = (tile.width + 2 * RADIUS) * cn;
+	const vector<int> offset = paddedOffsets(x, tile);
+
+	// per moment, rings of the horizontal boxes and of boxes 1 and 2 down the columns, and the running row of box 3
+	vector<T> line(padded), boxed(padded), rows((size_t)count * 13 * width);
+	auto ring = [&](int k, int box, int r) { return &rows[((size_t)k * 13 + box * 4 + (r & 3)) * width]; };
+	for (int v = -3; v < tile.height + 3; v++) {
+		const int sy = reflect101(tile.y + v, x.rows);
+		const T* xr = x.ptr<T>(sy);
+		const T* yr = y.ptr<T>(sy);
+
+		for (int k = 0; k < count; k++) {
+			// the boxes along the row need 1, 2 and 3 pixels around the tile
+			loadMoment(moments[k], xr, yr, offset.data(), padded, line.data());
+			sumRow(level, &line[2 * cn], &line[3 * cn], &line[4 * cn], false, width + 4 * cn, &boxed[3 * cn]);
+			sumRow(level, &boxed[3 * cn], &boxed[4 * cn], &boxed[5 * cn], false, width + 2 * cn, &line[4 * cn]);
+			sumRow(level, &line[4 * cn], &line[5 * cn], &line[6 * cn], false, width, ring(k, 0, v));
+
+			// box k down the columns at row v - k, which starts k - 3 rows above the tile
+			for (int box = 1; box <= 3; box++) {
+				const int r = v - box;
+				if (r < box - 3) break;
+				T* o = box < 3 ? ring(k, box, r) : &rows[((size_t)k * 13 + 12) * width];
+				if (boxRestarts(box, r)) sumRow(level, ring(k, box - 1, r - 1), ring(k, box - 1, r), ring(k, box - 1, r + 1), false, width, o);
+				else sumRow(level, box < 3 ? ring(k, box, r - 1) : o, ring(k, box - 1, r + 1), ring(k, box - 1, r - 2), true, width, o);
+				if (box == 3) scaleRow(level, o, (T)BOX_SCALE, width, out[k] + (size_t)r * step);
+			}
+		}
+	}
+}
+
+template <typename T>
+void blurTile(const Mat& x, const Mat& y, const Moment* moments, int count, Blur blur, Rect tile, T* const* out, size_t step) {
+	if (blur == Blur::Box) {
+		boxTile(x, y, moments, count, tile, out, step);
+		return;
+	}
+	const CpuLevel level = cpuLevel();
+	const int cn = x.channels();
+	const int width = tile.width * cn, padded = (tile.width + 2 * RADIUS) * cn;
+	const vector<int> offset = paddedOffsets(x, tile);
+
+	vector<T> line(padded), ring((size_t)count * TAPS * width);
+	const T* shifted[TAPS];
+	for (int t = 0; t < TAPS; t++) shifted[t] = &line[t * cn];
+	for (int v = tile.y - RADIUS; v < tile.y + tile.height + RADIUS; v++) {
+		int sy = reflect101(v, x.rows);
+		const T* xr = x.ptr<T>(sy);
+		const T* yr = y.ptr<T>(sy);
+		int slot = (v - tile.y + RADIUS) % TAPS;
+
+		for (int k = 0; k < count; k++) {
+			loadMoment(moments[k], xr, yr, offset.data(), padded, line.data());
+			blurRow(level, shifted, width, &ring[((size_t)k * TAPS + slot) * width]);
+		}
+
+		// the row RADIUS above v now has all of its source rows
+		int oy = v - RADIUS;
+		if (oy < tile.y) continue;
+		for (int k = 0; k < count; k++) {
+			const T* r[TAPS];
+			for (int t = 0; t < TAPS; t++) r[t] = &ring[((size_t)k * TAPS + (oy - tile.y + t) % TAPS) * width];
+			blurRow(level, r, width, out[k] + (size_t)(oy - tile.y) * step);
+		}
+	}
+}
+
+// Tiles of a plane whose rings stay within RING_BYTES
+struct Tiling {
+	int cols, tilesX, tilesY;
+	int count() const { return tilesX * tilesY; }
+};
+
+template <typename T>
+static Tiling tiling(const Mat& x, int count) {
+	Tiling t;
+	t.cols = max(16, (int)(RING_BYTES / (sizeof(T) * TAPS * count * x.channels())));
+	t.tilesX = (x.cols + t.cols - 1) / t.cols;
+	t.tilesY = (x.rows + BAND_ROWS - 1) / BAND_ROWS;
+	t.cols = (x.cols + t.tilesX - 1) / t.tilesX;
+	return t;
+}
+
+template <typename T>
+static void blurTileOf(const Mat& x, const Mat& y, const Moment* moments, int count, Blur blur, const Tiling& t, int i, Mat* out) {
+	Rect tile((i % t.tilesX) * t.cols, (i / t.tilesX) * BAND_ROWS, 0, 0);
+	tile.width = min(t.cols, x.cols - tile.x);
+	tile.height = min(BAND_ROWS, x.rows - tile.y);
+	T* o[4];
+	for (int k = 0; k < count; k++) o[k] = out[k].ptr<T>(tile.y) + tile.x * x.channels();
+	blurTile<T>(x, y, moments, count, blur, tile, o, out[0].step1());
+}
+
+template <typename T>
+static void blurScales(const Planes* img, int scales, Blur blur, Planes* mu, MatAllocator* allocator) {
+	const Moment moment = Moment::X;
+	const int planes = (int)img[0].size();
+	vector<Tiling> t(scales);
+	vector<int> first(1, 0);
+	for (int s = 0; s < scales; s++) {
+		mu[s].resize(planes);
+		for (int c = 0; c < planes; c++)
+			if (img[s][c].empty()) mu[s][c].release();
+			else allocate(mu[s][c], img[s][c].size(), img[s][c].type(), allocator);
+		t[s] = tiling<T>(img[s][0], 1);
+		first.push_back(first.back() + planes * t[s].count());
+	}
+	parallel_for_(Range(0, first.back()), [&](const Range& range) {
+		for (int i = range.start; i < range.end; i++) {
+			const int s = (int)(upper_bound(first.begin(), first.end(), i) - first.begin()) - 1;
+			const int c = (i - first[s]) / t[s].count();
+			if (img[s][c].empty()) continue;
+			blurTileOf<T>(img[s][c], img[s][c], &moment, 1, blur, t[s], (i - first[s]) % t[s].count(), &mu[s][c]);
+		}
+	});
+}
+
+void blurScales(const Planes* img, int scales, Blur blur, Planes* mu, MatAllocator* allocator) {
+	CV_Assert(scales > 0 && scales <= 6 && !img[0].empty());
+	if (img[0][0].depth() == CV_32F) blurScales<float>(img, scales, blur, mu, allocator);
+	else blurScales<double>(img, scales, blur, mu, allocator);
+}
+
+template void blurTile<double>(const Mat&, const Mat&, const Moment*, int, Blur, Rect, double* const*, size_t);
+template void blurTile<float>(const Mat&, const Mat&, const Moment*, int, Blur, Rect, float* const*, size_t);
+
+}
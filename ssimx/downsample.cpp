@@ -0,0 +1,147 @@
+/*
+	Halving planes for the pyramid, as resize(0.5, INTER_AREA) does it.
+
+	Licensed under the Apache License, Version 2.0; see libssimx.cpp for the full notice.
+
+	Every output pixel is the average of a 2x2 block of the plane above. The output size is rounded
+	the way resize rounds it, and on planes of odd width or height the blocks on the right and
+	bottom edges are cut short and averaged over the pixels they have, like resize does.
+
+	The SIMD versions split the pixels of both rows into even and odd ones and add them in the same
+	order as the portable loop, ((a0 + a1) + b0) + b1, so all of them give the same values. The
+	4x4 blocks of the worst-block term are not made here: the scoring tiles average them as they go
+	(see ssimmap.cpp).
+*/
+
+#include "kernels.h"
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#ifdef SSIMX_X86
+#include <immintrin.h>
+#endif
+
+using namespace std;
+using namespace cv;
+
+namespace ssimx {
+
+#ifdef SSIMX_X86
+
+// Whole 2x2 blocks x0, x0 + 1... of rows r0 and r1, one vector at a time; returns the first block not done
+
+SSIMX_TARGET_AVX2 static int downsampleAVX2(const double* r0, const double* r1, int x0, int x1, double* out) {
+	const __m256d quarter = _mm256_set1_pd(0.25);
+	int x = x0;
+	for (; x + 4 <= x1; x += 4) {
+		const __m256d a0 = _mm256_loadu_pd(r0 + 2 * x), a1 = _mm256_loadu_pd(r0 + 2 * x + 4);
+		const __m256d b0 = _mm256_loadu_pd(r1 + 2 * x), b1 = _mm256_loadu_pd(r1 + 2 * x + 4);
+		// blocks 0 2 1 3, put back in order by the permute
+		__m256d s = _mm256_add_pd(_mm256_unpacklo_pd(a0, a1), _mm256_unpackhi_pd(a0, a1));
+		s = _mm256_add_pd(_mm256_add_pd(s, _mm256_unpacklo_pd(b0, b1)), _mm256_unpackhi_pd(b0, b1));
+		_mm256_storeu_pd(out + x, _mm256_permute4x64_pd(_mm256_mul_pd(s, quarter), _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+	return x;
+}
+
+SSIMX_TARGET_AVX2 static int downsampleAVX2(const float* r0, const float* r1, int x0, int x1, float* out) {
+	const __m256 quarter = _mm256_set1_ps(0.25f);
+	int x = x0;
+	for (; x + 8 <= x1; x += 8) {
+		const __m256 a0 = _mm256_loadu_ps(r0 + 2 * x), a1 = _mm256_loadu_ps(r0 + 2 * x + 8);
+		const __m256 b0 = _mm256_loadu_ps(r1 + 2 * x), b1 = _mm256_loadu_ps(r1 + 2 * x + 8);
+		// pairs of blocks 01 45 23 67, put back in order by the permute
+		__m256 s = _mm256_add_ps(_mm256_shuffle_ps(a0, a1, _MM_SHUFFLE(2, 0, 2, 0)), _mm256_shuffle_ps(a0, a1, _MM_SHUFFLE(3, 1, 3, 1)));
+		s = _mm256_add_ps(_mm256_add_ps(s, _mm256_shuffle_ps(b0, b1, _MM_SHUFFLE(2, 0, 2, 0))), _mm256_shuffle_ps(b0, b1, _MM_SHUFFLE(3, 1, 3, 1)));
+		s = _mm256_mul_ps(s, quarter);
+		_mm256_storeu_ps(out + x, _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(s), _MM_SHUFFLE(3, 1, 2, 0))));
+	}
+	return x;
+}
+
+SSIMX_TARGET_AVX512 static int downsampleAVX512(const double* r0, const double* r1, int x0, int x1, double* out) {
+	const __m512d quarter = _mm512_set1_pd(0.25);
+	const __m512i even = _mm512_setr_epi64(0, 2, 4, 6, 8, 10, 12, 14), odd = _mm512_setr_epi64(1, 3, 5, 7, 9, 11, 13, 15);
+	int x = x0;
+	for (; x + 8 <= x1; x += 8) {
+		const __m512d a0 = _mm512_loadu_pd(r0 + 2 * x), a1 = _mm512_loadu_pd(r0 + 2 * x + 8);
+		const __m512d b0 = _mm512_loadu_pd(r1 + 2 * x), b1 = _mm512_loadu_pd(r1 + 2 * x + 8);
+		__m512d s = _mm512_add_pd(_mm512_permutex2var_pd(a0, even, a1), _mm512_permutex2var_pd(a0, odd, a1));
+		s = _mm512_add_pd(_mm512_add_pd(s, _mm512_permutex2var_pd(b0, even, b1)), _mm512_permutex2var_pd(b0, odd, b1));
+		_mm512_storeu_pd(out + x, _mm512_mul_pd(s, quarter));
+	}
+	return x;
+}
+
+SSIMX_TARGET_AVX512 static int downsampleAVX512(const float* r0, const float* r1, int x0, int x1, float* out) {
+	const __m512 quarter = _mm512_set1_ps(0.25f);
+	const __m512i even = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+	const __m512i odd = _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31);
+	int x = x0;
+	for (; x + 16 <= x1; x += 16) {
+		const __m512 a0 = _mm512_loadu_ps(r0 + 2 * x), a1 = _mm512_loadu_ps(r0 + 2 * x + 16);
+		const __m512 b0 = _mm512_loadu_ps(r1 + 2 * x), b1 = _mm512_loadu_ps(r1 + 2 * x + 16);
+		__m512 s = _mm512_add_ps(_mm512_permutex2var_ps(a0, even, a1), _mm512_permutex2var_ps(a0, odd, a1));
+		s = _mm512_add_ps(_mm512_add_ps(s, _mm512_permutex2var_ps(b0, even, b1)), _mm512_permutex2var_ps(b0, odd, b1));
+		_mm512_storeu_ps(out + x, _mm512_mul_ps(s, quarter));
+	}
+	return x;
+}
+
+#endif
+
+template <typename T>
+void downsampleRow(const T* r0, const T* r1, int width, int x0, int x1, T* out) {
+	const int full = r1 ? width / 2 : 0;
+	int x = x0;
+#ifdef SSIMX_X86
+	if (x < full) {
+		const CpuLevel level = cpuLevel();
+		if (level == CpuLevel::AVX512) x = downsampleAVX512(r0, r1, x, min(x1, full), out);
+		else if (level == CpuLevel::AVX2) x = downsampleAVX2(r0, r1, x, min(x1, full), out);
+	}
+#endif
+	for (; x < x1; x++) {
+		const T* a = r0 + 2 * x;
+		const T* b = r1 ? r1 + 2 * x : nullptr;
+		if (x < full) {
+			out[x] = (T)((a[0] + a[1] + b[0] + b[1]) * 0.25f);
+			continue;
+		}
+		const bool pair = 2 * x + 1 < width;
+		T s = a[0];
+		int count = 1;
+		if (pair) { s += a[1]; count++; }
+		if (b) { s += b[0]; count++; }
+		if (b && pair) { s += b[1]; count++; }
+		out[x] = (T)((float)s / count);
+	}
+}
+
+template <typename T>
+static void downsample(const Mat& src, Mat& dst) {
+	parallel_for_(Range(0, dst.rows), [&](const Range& range) {
+		for (int y = range.start; y < range.end; y++) {
+			const bool pair = 2 * y + 1 < src.rows;
+			downsampleRow(src.ptr<T>(2 * y), pair ? src.ptr<T>(2 * y + 1) : nullptr, src.cols, 0, dst.cols, dst.ptr<T>(y));
+		}
+	});
+}
+
+void downsample(const Planes& src, Planes& dst, MatAllocator* allocator) {
+	dst.resize(src.size());
+	for (size_t c = 0; c < src.size(); c++) {
+		if (src[c].empty()) {
+			dst[c] = Mat();
+			continue;
+		}
+		allocate(dst[c], Size(cvRound(src[c].cols * 0.5), cvRound(src[c].rows * 0.5)), src[c].type(), allocator);
+		if (src[c].depth() == CV_32F) downsample<float>(src[c], dst[c]);
+		else downsample<double>(src[c], dst[c]);
+	}
+}
+
+template void downsampleRow<double>(const double*, const double*, int, int, int, double*);
+template void downsampleRow<float>(const float*, const float*, int, int, int, float*);
+
+}
@@ -0,0 +1,168 @@
+/*
+	Internal kernels of libssimx.
+
+	Licensed under the Apache License, Version 2.0; see libssimx.cpp for the full notice.
+
+	Kernels work on raw rows (or, for the blur, on whole planes) so the hot loops don't depend on
+	cv::Mat accessors. Row kernels have a portable implementation and, on x86, AVX2 and AVX-512
+	versions picked at runtime.
+
+	Past the Lab conversion, images are kept as one single-channel plane per channel (L, a, b and
+	alpha), so every channel is blurred and scored on its own, with no interleaving in the loops.
+*/
+
+#pragma once
+
+#include "ssimx.h"
+
+#include <opencv2/opencv.hpp>
+#include <functional>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SSIMX_X86 1
+#endif
+
+// GCC and Clang only emit AVX code inside functions that ask for it; MSVC always can.
+#if defined(SSIMX_X86) && defined(__GNUC__)
+#define SSIMX_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define SSIMX_TARGET_AVX512 __attribute__((target("avx512f,avx2,fma")))
+#else
+#define SSIMX_TARGET_AVX2
+#define SSIMX_TARGET_AVX512
+#endif
+
+// The SIMD kernels and their portable versions only give the same bits if neither fuses a multiply and
+// an add, which GCC and Clang do by default wherever FMA is available (inside SSIMX_TARGET_AVX2 included).
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#elif defined(_MSC_VER)
+#pragma fp_contract(off)
+#endif
+
+namespace ssimx {
+
+// SSIM constants. Original C2 was 0.0009, but a smaller value seems to work slightly better.
+const double C1 = 0.0001, C2 = 0.0004;
+
+enum class CpuLevel {
+	Scalar,
+	AVX2,
+	AVX512,
+};
+
+// Best instruction set supported by this CPU (and by the build); detected once
+CpuLevel cpuLevel();
+
+// Convert n interleaved linear BGR(A) pixels (cn = 3 or 4) to L*a*b* in a 0..1 range, in place.
+// Alpha is left alone. The SIMD versions use a cube root that is within 1 ulp of the exact one.
+template <typename T>
+void rgb2labRow(T* row, int n, int cn);
+
+// The channels of an image, one CV_64F or CV_32F plane each: L, a, b, alpha (or just gray)
+typedef std::vector<cv::Mat> Planes;
+
+// m.create(size, type), from allocator (a Workspace) when it is not null
+inline void allocate(cv::Mat& m, cv::Size size, int type, cv::MatAllocator* allocator) {
+	if (allocator) m.allocator = allocator;
+	m.create(size, type);
+}
+
+// Per-pixel products of two images x and y that blurTile can blur
+enum class Moment {
+	X,
+	Y,
+	XY,
+	XXYY,   // x^2 + y^2
+};
+
+// The blur of every plane of every scale of a pyramid into mu[0..scales), allocated from allocator, with the tiles of all
+// of them in one parallel loop. Empty planes stay empty.
+void blurScales(const Planes* img, int scales, Blur blur, Planes* mu, cv::MatAllocator* allocator);
+
+// GaussianBlur(Size(11, 11), 1.5) of count moments of x and y (same size and type, CV_64F or CV_32F, any channel count),
+// or its box approximation (see blur.cpp), for the pixels of tile only (reading up to 5 pixels around it), in one pass
+// over the images, written to out[k] + row * step. With Blur::Box, values only don't depend on the tiling if tiles
+// start at multiples of 16 rows of the scale.
+template <typename T>
+void blurTile(const cv::Mat& x, const cv::Mat& y, const Moment* moments, int count, Blur blur, cv::Rect tile, T* const* out,
+	size_t step);
+
+// Sums of every row and every column of a map, per channel: rows[y * cn + c] and cols[x * cn + c]
+struct LineSums {
+	std::vector<double> rows, cols;
+};
+
+void lineSums(const cv::Mat& map, LineSums& lines);
+
+// Everything one plane of one scale contributes to the score
+struct PlaneStats {
+	double mean;            // mean SSIM
+	double min;             // lowest average of a 4x4 block of the SSIM map, with blocks as made by resize(0.25, INTER_AREA)
+	double edgeMean;        // the rest only with edges: mean of 1 - edgediff,
+	LineSums ssimLines;     // line sums of the SSIM map
+	LineSums edgeLines;     // and line sums of 1 - edgediff
+	bool identical = false; // the plane is the same in both images: all of the above is 1, without line sums
+};
+
+struct ScaleStats {
+	PlaneStats plane[4];
+};
+
+// What one tile contributes to the reductions of its plane
+struct TileResult {
+	std::vector<double> rows, cols;          // SSIM line sums over the tile (columns only at scale 0)
+	std::vector<double> edgeRows, edgeCols;  // line sums of 1 - edgediff, scale 0 only
+	double min;
+};
+
+// Score the scales of the original (img1 and its blur mu1) and distorted (img2) pyramids, tile by tile, with the tiles of
+// every plane of every scale in one parallel loop; see ssimmap.cpp. Scale 0 adds the artifact-edge map
+// max(|img2 - mu2| - |img1 - mu1|, 0) and the line sums for grid detection. Its SSIM and edge maps are only written out when not null.
+// Planes left empty (in all three pyramids) are skipped, leaving their stats alone; their maps are 1 and 0.
+// The results of every tile are left in tiles when not null, for rescoreScales. mu1 has to come from the same blur.
+void scoreScales(const Planes* img1, const Planes* mu1, const Planes* img2, int scales, Blur blur, ScaleStats* stats,
+	Planes* ssim, Planes* edgediff, std::vector<TileResult>* tiles = nullptr);
+
+// After img2 changed inside dirty[s] at every scale s, score again only the tiles that see the change and update their
+// results in tiles and the stats, to the same values scoreScales would give
+void rescoreScales(const Planes* img1, const Planes* mu1, const Planes* img2, int scales, Blur blur, const cv::Rect* dirty,
+	std::vector<TileResult>& tiles, ScaleStats* stats);
+
+// Scales are scored in tiles this many rows high
+const int TILE_ROWS = 64;
+
+// Score rows [y0, y1) of a scale of the given size only, with bands scored top to bottom into the same stats; edges as for scale 0 above.
+// The planes hold rows [top, top + rows) of the scale, which have to include 5 rows around the band where the
+// scale has them; y0 is a multiple of TILE_ROWS. An empty mu1 is computed on the fly. Empty planes are skipped. The maps,
+// when not null, are written at the rows of the planes.
+void scoreRows(const Planes& img1, const Planes& mu1, const Planes& img2, int top, cv::Size size, int y0, int y1,
+	bool edges, Blur blur, ScaleStats& stats, Planes* ssim, Planes* edgediff);
+
+// Memory scoreRows needs for a band besides the planes and the stats: tile results, and buffers on every thread
+size_t scoreRowsMemory(int width, int rows, int planes, int depth, bool edges, Blur blur);
+
+// Writes rows [begin, end) of an image, converted to the working format, to the rows of the planes of dst
+typedef std::function<void(int begin, int end, Planes& dst)> RowSource;
+
+// Pixels [x0, x1) of one row of resize(0.5, INTER_AREA) of a plane of the given width: 2x2 pixel averages, and averages
+// of what is left of them on the right and bottom edges, where r1 is null; see downsample.cpp
+template <typename T>
+void downsampleRow(const T* r0, const T* r1, int width, int x0, int x1, T* out);
+
+// resize(0.5, INTER_AREA) of every plane of src into dst, allocated from allocator, rows in parallel; empty planes stay empty
+void downsample(const Planes& src, Planes& dst, cv::MatAllocator* allocator);
+
+// Score every scale of two images of the given size, made of planes of the given depth, without holding any scale
+// whole, in bands of rows as high as maxMemory bytes allow (allocated from allocator); see stream.cpp. With
+// subsampledChroma, planes 1 and 2 are skipped at scale 0. Returns the number of scales, or 0 when not even one band of
+// tiles fits.
+int streamScales(cv::Size size, int depth, int planes, bool subsampledChroma, Blur blur, const RowSource& original,
+	const RowSource& distorted, size_t maxMemory, cv::MatAllocator* allocator, ScaleStats* stats);
+
+// The 2nd percentile lowest row mean and column mean of each channel of a width x height map, in linear time
+void worstLines(const LineSums& lines, int width, int height, int cn, double* worstRow, double* worstCol);
+
+}
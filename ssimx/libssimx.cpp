@@ -0,0 +1,926 @@
+/*
+	SSIMULACRA - Structural SIMilarity Unveiling Local And Compression Related Artifacts
+
+	Cloudinary's variant of DSSIM, based on Philipp Klaus Krause's adaptation of Rabah Mehdi's SSIM implementation,
+	using ideas from Kornel Lesinski's DSSIM implementation as well as several new ideas.
+
+	May 2016 - Feb 2017, Jon Sneyers <jon@cloudinary.com>
+
+	Copyright 2017, Cloudinary
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+
+	Changes compared to Krause's SSIM implementation:
+	- Use C++ OpenCV API
+	- Convert sRGB to linear RGB and then to L*a*b*, to get a perceptually more accurate color space
+	- Multi-scale (6 scales)
+	- Extra penalty for specific kinds of artifacts:
+		- local artifacts
+		- grid-like artifacts (blockiness)
+		- introducing edges where the original is smooth (blockiness / color banding / ringing / mosquito noise)
+
+	Known limitations:
+	- Color profiles are ignored; input images are assumed to be sRGB.
+	- Both input images need to have the same number of channels (Grayscale / RGB / RGBA)
+*/
+
+/*
+	This DSSIM program has been created by Philipp Klaus Krause based on
+	Rabah Mehdi's C++ implementation of SSIM (http://mehdi.rabah.free.fr/SSIM).
+	Originally it has been created for the VMV '09 paper
+	"ftc - floating precision texture compression" by Philipp Klaus Krause.
+
+	The latest version of this program can probably be found somewhere at
+	http://www.colecovision.eu.
+
+	It can be compiled using g++ -I/usr/include/opencv -lcv -lhighgui dssim.cpp
+	Make sure OpenCV is installed (e.g. for Debian/ubuntu: apt-get install
+	libcv-dev libhighgui-dev).
+
+	DSSIM is described in
+	"Structural Similarity-Based Object Tracking in Video Sequences" by Loza et al.
+	however setting all Ci to 0 as proposed there results in numerical instabilities.
+	Thus this implementation used the Ci from the SSIM implementation.
+	SSIM is described in
+	"Image quality assessment: from error visibility to structural similarity" by Wang et al.
+*/
+
+/*
+	Copyright (c) 2005, Rabah Mehdi <mehdi.rabah@gmail.com>
+
+	Feel free to use it as you want and to drop me a mail
+	if it has been useful to you. Please let me know if you enhance it.
+	I'm not responsible if this program destroy your life & blablabla :)
+
+	Copyright (c) 2009, Philipp Klaus Krause <philipp@colecovision.eu>
+
+	Permission to use, copy, modify, and/or distribute this software for any
+	purpose with or without fee is hereby granted, provided that the above
+	copyright notice and this permission notice appear in all copies.
+
+	THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+	WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+	MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+	ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+	WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+	ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+	OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "ssimx.h"
+#include "kernels.h"
+
+#include <opencv2/opencv.hpp>
+#include <avif/avif.h>
+#include <limits>
+#include <memory>
+#include <stdint.h>
+#include <stdio.h>
+
+// comment this in to produce debug images that show the differences at each scale
+//#define DEBUG_IMAGES 1
+using namespace std;
+using namespace cv;
+
+namespace ssimx {
+
+// All of the constants below are more or less arbitrary.
+// Some amount of tweaking/calibration was done, but there is certainly room for improvement.
+
+// SSIM constants C1 and C2 are in kernels.h
+
+// Weight of each scale. Somewhat arbitrary.
+// These are based on the values used in IW-SSIM and Kornel's DSSIM.
+// It seems weird to give so little weight to the full-size scale, but then again,
+// differences in more zoomed-out scales have more visual impact.
+// Anyway, these weights seem to work.
+// Added one more scale compared to IW-SSIM and Kornel's DSSIM.
+// Weights for chroma are modified to give more weight to larger scales (similar to Kornel's subsampled chroma)
+constexpr double scale_weights[4][6] = {
+	// 1:1   1:2     1:4     1:8     1:16    1:32
+	{0.0448, 0.2856, 0.3001, 0.2363, 0.1333, 0.1  },
+	{0.015,  0.0448, 0.2856, 0.3001, 0.3363, 0.25 },
+	{0.015,  0.0448, 0.2856, 0.3001, 0.3363, 0.25 },
+	{0.0448, 0.2856, 0.3001, 0.2363, 0.1333, 0.1  },
+};
+
+// higher value means more importance to chroma (weights above are multiplied by this factor for chroma and alpha)
+constexpr double chroma_weight = 0.2;
+
+// Weights for the worst-case (minimum) score at each scale.
+// Higher value means more importance to worst artifacts, lower value means more importance to average artifacts.
+constexpr double mscale_weights[4][6] = {
+	// 1:4   1:8     1:16    1:32   1:64   1:128
+	{0.2,    0.3,    0.25,   0.2,   0.12,  0.05},
+	{0.01,   0.05,   0.2,    0.3,   0.35,  0.35},
+	{0.01,   0.05,   0.2,    0.3,   0.35,  0.35},
+	{0.2,    0.3,    0.25,   0.2,   0.12,  0.05},
+};
+
+
+// higher value means more importance to worst local artifacts
+constexpr double min_weight[4] = { 0.1,0.005,0.005,0.005 };
+
+// higher value means more importance to artifact-edges (edges where original is smooth)
+constexpr double extra_edges_weight[4] = { 1.5, 0.1, 0.1, 0.5 };
+
+// higher value means more importance to grid-like artifacts (blockiness)
+constexpr double worst_grid_weight[2][4] =
+{ {1.0, 0.1, 0.1, 0.5},             // on ssim heatmap
+  {1.0, 0.1, 0.1, 0.5} };           // on extra_edges heatmap
+
+
+// Whether channel i of an image with nChan channels has terms at a scale: with subsampled chroma, a and b start at 1:2
+constexpr bool scored(unsigned int nChan, unsigned int i, int scale, bool subsampledChroma) {
+	return !(subsampledChroma && scale == 0 && nChan >= 3 && (i == 1 || i == 2));
+}
+
+template <unsigned int nChan>
+static void grid_artifacts(const ScaleStats& stats, Size size, bool subsampledChroma, double& score, int twice) {
+	// grid-like artifact detection
+	// do the things below twice: once for the SSIM map, once for the artifact-edge map
+
+	double worstRow[4], worstCol[4];
+	for (unsigned int i = 0; i < nChan; i++) {
+		const PlaneStats& plane = stats.plane[i];
+		if (!scored(nChan, i, 0, subsampledChroma)) continue;
+		if (plane.identical) {
+			worstRow[i] = worstCol[i] = 1;
+			continue;
+		}
+		worstLines(twice ? plane.edgeLines : plane.ssimLines, size.width, size.height, 1, &worstRow[i], &worstCol[i]);
+	}
+
+	  // Find the 2nd percentile worst row. If the compression uses blocks, there will be artifacts around the block edges,
+	  // so even with 32x32 blocks, the 2nd percentile will likely be one of the rows with block borders
+	for (unsigned int i = 0; i < nChan; i++)
+		if (scored(nChan, i, 0, subsampledChroma)) score += worst_grid_weight[twice][i] * worstRow[i];
+	// Find the 2nd percentile worst column. Same concept as above.
+	for (unsigned int i = 0; i < nChan; i++)
+		if (scored(nChan, i, 0, subsampledChroma)) score += worst_grid_weight[twice][i] * worstCol[i];
+}
+
+const char* statusString(Status status) {
+	switch (status) {
+	case Status::Ok: return "OK";
+	case Status::ReadError: return "Cannot open file for read";
+	case Status::DecodeError: return "Failed to decode image";
+	case Status::Unsupported: return "Can only deal with 8 or 16-bit Grayscale, RGB or RGBA input";
+	case Status::TooSmall: return "Image is too small; need at least 8 rows and columns";
+	case Status::SizeMismatch: return "Image dimensions have to be identical";
+	case Status::ChannelMismatch: return "Images have incompatible channel counts";
+	case Status::InvalidArgument: return "Invalid argument";
+	case Status::OutOfMemory: return "Out of memory";
+	case Status::InternalError: return "Internal error";
+	}
+	return "Unknown error";
+}
+
+// decoder already has its IO set up. Only the first frame of a sequence is decoded, on as many threads as OpenCV uses,
+// straight into img as BGRA: 8 bits deep, or 16 (full range) for 10 and 12-bit images.
+static Status readAvif(avifDecoder* decoder, Mat& img) {
+	decoder->maxThreads = max(1, getNumThreads());
+	if (avifDecoderParse(decoder) != AVIF_RESULT_OK) return Status::DecodeError;
+	if (avifDecoderNthImage(decoder, 0) != AVIF_RESULT_OK) return Status::DecodeError;
+
+	avifRGBImage rgb;
+	memset(&rgb, 0, sizeof(rgb));
+	avifRGBImageSetDefaults(&rgb, decoder->image);
+	rgb.format = AVIF_RGB_FORMAT_BGRA;
+	rgb.depth = decoder->image->depth > 8 ? 16 : 8;
+
+	// libavif writes into the Mat's own buffer
+	img.create(rgb.height, rgb.width, rgb.depth == 16 ? CV_16UC4 : CV_8UC4);
+	rgb.pixels = img.data;
+	rgb.rowBytes = (uint32_t)img.step;
+	if (avifImageYUVToRGB(decoder->image, &rgb) != AVIF_RESULT_OK) {
+		img.release();
+		return Status::DecodeError;
+	}
+	return Status::Ok;
+}
+
+Status decodeFile(const string& filename, Mat& img) {
+	try {
+		string extension = filename.substr(filename.find_last_of(".") + 1);
+
+		if (extension == "avif") {
+			avifDecoder* decoder = avifDecoderCreate();
+			Status status = Status::ReadError;
+			if (avifDecoderSetIOFile(decoder, filename.c_str()) == AVIF_RESULT_OK) status = readAvif(decoder, img);
+			avifDecoderDestroy(decoder);
+			return status;
+		}
+
+		FILE* f = fopen(filename.c_str(), "rb");
+		if (!f) return Status::ReadError;
+		fclose(f);
+
+		img = imread(filename, IMREAD_UNCHANGED);
+		return img.empty() ? Status::DecodeError : Status::Ok;
+	}
+	catch (const bad_alloc&) { return Status::OutOfMemory; }
+	catch (const exception&) { return Status::DecodeError; }
+}
+
+Status decodeMemory(const void* data, size_t size, Mat& img) {
+	if (!data || size == 0) return Status::InvalidArgument;
+	try {
+		// ISOBMFF: the ftyp box comes first, with the major brand right after it
+		const uchar* bytes = (const uchar*)data;
+		if (size >= 12 && memcmp(bytes + 4, "ftyp", 4) == 0 && (memcmp(bytes + 8, "avif", 4) == 0 || memcmp(bytes + 8, "avis", 4) == 0)) {
+			avifDecoder* decoder = avifDecoderCreate();
+			Status status = Status::DecodeError;
+			if (avifDecoderSetIOMemory(decoder, bytes, size) == AVIF_RESULT_OK) status = readAvif(decoder, img);
+			avifDecoderDestroy(decoder);
+			return status;
+		}
+
+		img = imdecode(Mat(1, (int)size, CV_8UC1, (void*)data), IMREAD_UNCHANGED);
+		return img.empty() ? Status::DecodeError : Status::Ok;
+	}
+	catch (const bad_alloc&) { return Status::OutOfMemory; }
+	catch (const exception&) { return Status::DecodeError; }
+}
+
+CpuLevel cpuLevel() {
+	static const CpuLevel level = [] {
+#ifdef SSIMX_X86
+		if (checkHardwareSupport(CV_CPU_AVX_512F)) return CpuLevel::AVX512;
+		if (checkHardwareSupport(CV_CPU_AVX2) && checkHardwareSupport(CV_CPU_FMA3)) return CpuLevel::AVX2;
+#endif
+		return CpuLevel::Scalar;
+	}();
+	return level;
+}
+
+static bool supported(const Mat& img) {
+	return (img.depth() == CV_8U || img.depth() == CV_16U) && (img.channels() == 1 || img.channels() == 3 || img.channels() == 4);
+}
+
+// 8-bit or 16-bit sRGB to linear RGB, for every value of S
+template <typename T, typename S>
+static const T* gammaTable() {
+	static const vector<T> table = [] {
+		const int top = numeric_limits<S>::max();
+		vector<T> t(top + 1);
+		for (int i = 0; i <= top; i++) {
+			double c = i / (double)top;
+			t[i] = (T)(c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4));
+		}
+		return t;
+	}();
+	return table.data();
+}
+
+// 8-bit or 16-bit gray to 0..1, which is all a grayscale image needs
+template <typename T, typename S>
+static const T* unitTable() {
+	static const vector<T> table = [] {
+		const int top = numeric_limits<S>::max();
+		vector<T> t(top + 1);
+		for (int i = 0; i <= top; i++) t[i] = (T)(i / (double)top);
+		return t;
+	}();
+	return table.data();
+}
+
+// Row a of the table blends a color value with opacity a to a gray background
+static const uchar* blendTable() {
+	static const vector<uchar> table = [] {
+		vector<uchar> t(256 * 256);
+		for (int a = 0; a < 256; a++)
+			for (int c = 0; c < 256; c++) t[a * 256 + c] = (uchar)((a * c + (255 - a) * 128) / 255);
+		return t;
+	}();
+	return table.data();
+}
+
+// Blends a color value with opacity alpha to the gray background: through the table for 8 bits, and for 16 bits,
+// which are too many for a table, with the same formula (gray being 128 * 257)
+struct GrayBlend {
+	const uchar* table = blendTable();
+
+	uchar operator()(uchar alpha, uchar c) const { return table[alpha * 256 + c]; }
+	ushort operator()(ushort alpha, ushort c) const {
+		return (ushort)(((uint32_t)alpha * c + (uint32_t)(65535 - alpha) * 32896) / 65535);
+	}
+};
+
+// Alpha of row y of an image as 16 bits, 8-bit values scaled by 257; img is an RGBA image, an alpha plane, or an RGB
+// (or empty) image, which is opaque
+static void alphaRow(const Mat& img, int y, int width, vector<ushort>& alpha) {
+	alpha.resize(width);
+	const int cn = img.empty() ? 3 : img.channels(), at = cn == 4 ? 3 : 0;
+	if (cn == 3) fill(alpha.begin(), alpha.end(), (ushort)65535);
+	else if (img.depth() == CV_16U)
+		for (int x = 0; x < width; x++) alpha[x] = img.ptr<ushort>(y)[x * cn + at];
+	else
+		for (int x = 0; x < width; x++) alpha[x] = (ushort)(img.ptr<uchar>(y)[x * cn + at] * 257);
+}
+
+// Whether two images have the same alpha everywhere, whatever their depths; see alphaRow. Stops at the first difference.
+static bool sameAlpha(const Mat& img1, const Mat& img2) {
+	const int cn1 = img1.empty() ? 3 : img1.channels(), cn2 = img2.empty() ? 3 : img2.channels();
+	if (cn1 == 3 && cn2 == 3) return true;
+	const Size size = cn1 != 3 ? img1.size() : img2.size();
+	vector<ushort> a, b;
+	for (int y = 0; y < size.height; y++) {
+		alphaRow(img1, y, size.width, a);
+		alphaRow(img2, y, size.width, b);
+		if (a != b) return false;
+	}
+	return true;
+}
+
+// Convert rows [y0, y1) of an 8-bit or 16-bit (S) sRGB(A) or grayscale image to Lab (or linear gray) in a 0..1 range,
+// with T = double or float elements, into the rows of the planes of img, where row begin of the image goes to row 0.
+// Each source row is read once, converted in the scratch row lab and spread over the planes; gray goes straight to its
+// plane through a table. nChan is the number of planes: a 3 channel image converted to 4 planes gets an opaque alpha
+// plane, and a 4 channel image converted to 3 planes is still blended but has no alpha plane.
+template <typename T, typename S>
+static void ingestRows(const Mat& src, ChannelOrder order, unsigned int nChan, int y0, int y1, int begin, Planes& img,
+	vector<T>& lab) {
+	const int cn = src.channels();
+
+	if (cn == 1) {
+		const T* unit = unitTable<T, S>();
+		for (int y = y0; y < y1; y++) {
+			const S* s = src.ptr<S>(y);
+			T* d = img[0].ptr<T>(y - begin);
+			for (int x = 0; x < src.cols; x++) d[x] = unit[s[x]];
+		}
+		return;
+	}
+
+	const int red = order == ChannelOrder::RGB ? 0 : 2;
+	const T* gamma = gammaTable<T, S>();
+	const GrayBlend blend;
+	lab.resize((size_t)src.cols * nChan);
+	for (int y = y0; y < y1; y++) {
+		const S* s = src.ptr<S>(y);
+		T* d = lab.data();
+		for (int x = 0; x < src.cols; x++, s += cn, d += nChan) {
+			// blend to a gray background to have a fair comparison of semi-transparent RGB values
+			const S alpha = cn == 4 ? s[3] : numeric_limits<S>::max();
+			d[0] = gamma[blend(alpha, s[2 - red])];
+			d[1] = gamma[blend(alpha, s[1])];
+			d[2] = gamma[blend(alpha, s[red])];
+			if (nChan == 4) d[3] = gamma[alpha];
+		}
+		rgb2labRow(lab.data(), src.cols, nChan);
+		for (unsigned int c = 0; c < nChan; c++) {
+			T* p = img[c].ptr<T>(y - begin);
+			for (int x = 0; x < src.cols; x++) p[x] = lab[(size_t)x * nChan + c];
+		}
+	}
+}
+
+template <typename T>
+static void ingestRows(const Mat& src, ChannelOrder order, unsigned int nChan, int y0, int y1, int begin, Planes& img,
+	vector<T>& lab) {
+	if (src.depth() == CV_16U) ingestRows<T, ushort>(src, order, nChan, y0, y1, begin, img, lab);
+	else ingestRows<T, uchar>(src, order, nChan, y0, y1, begin, img, lab);
+}
+
+// ingestRows of rows [begin, end), in parallel
+template <typename T>
+static void ingest(const Mat& src, ChannelOrder order, unsigned int nChan, int begin, int end, Planes& img) {
+	parallel_for_(Range(begin, end), [&](const Range& range) {
+		vector<T> lab;
+		ingestRows<T>(src, order, nChan, range.start, range.end, begin, img, lab);
+	});
+}
+
+static void ingest(const Mat& src, ChannelOrder order, unsigned int nChan, int begin, int end, Planes& img, Precision precision) {
+	if (precision == Precision::Float) ingest<float>(src, order, nChan, begin, end, img);
+	else ingest<double>(src, order, nChan, begin, end, img);
+}
+
+// Size of the scale below one of the given size, as made by downsample()
+static Size halfSize(Size size) {
+	return Size(cvRound(size.width * 0.5), cvRound(size.height * 0.5));
+}
+
+// Scales of an image of the given size: halved as long as both sides stay at 8 pixels or more, 6 at most
+static int scaleCount(Size size) {
+	int scales = 1;
+	for (size = halfSize(size); scales < 6 && size.width >= 8 && size.height >= 8; size = halfSize(size)) scales++;
+	return scales;
+}
+
+// A whole image for ingest() to convert to nChan planes in img and, when half is not null, to halve into half
+struct Conversion {
+	const Mat* src;
+	ChannelOrder order;
+	unsigned int nChan;
+	Planes* img;
+	Planes* half;
+};
+
+// Convert count images of the same size whole, into planes allocated from allocator, and halve them for the scale
+// below: every pair of rows is downsampled right after it is converted, while it is still in cache, with the rows of
+// all images in the same pass, instead of reading the full-resolution planes back from memory.
+template <typename T>
+static void ingest(const Conversion* images, int count, MatAllocator* allocator) {
+	const Size size = images[0].src->size(), half = halfSize(size);
+	const int type = DataType<T>::type;
+	for (int i = 0; i < count; i++) {
+		images[i].img->assign(images[i].nChan, Mat());
+		for (Mat& plane : *images[i].img) allocate(plane, size, type, allocator);
+		if (!images[i].half) continue;
+		images[i].half->assign(images[i].nChan, Mat());
+		for (Mat& plane : *images[i].half) allocate(plane, half, type, allocator);
+	}
+
+	parallel_for_(Range(0, (size.height + 1) / 2), [&](const Range& range) {
+		vector<T> lab;
+		for (int y = range.start; y < range.end; y++) {
+			const int y0 = 2 * y, y1 = min(y0 + 2, size.height);
+			for (int i = 0; i < count; i++) {
+				const Conversion& image = images[i];
+				ingestRows<T>(*image.src, image.order, image.nChan, y0, y1, 0, *image.img, lab);
+				// an odd last row can be left out of the scale below (see halfSize)
+				if (!image.half || y >= half.height) continue;
+				for (unsigned int c = 0; c < image.nChan; c++) {
+					const Mat& plane = (*image.img)[c];
+					downsampleRow(plane.ptr<T>(y0), y1 - y0 == 2 ? plane.ptr<T>(y0 + 1) : nullptr, size.width, 0, half.width,
+						(*image.half)[c].ptr<T>(y));
+				}
+			}
+		}
+	});
+}
+
+static void ingest(const Conversion* images, int count, Precision precision, MatAllocator* allocator) {
+	if (precision == Precision::Float) ingest<float>(images, count, allocator);
+	else ingest<double>(images, count, allocator);
+}
+
+// The scales of a pyramid below the ones it has, down to scales - 1
+static void downscale(Planes* pyramid, int scales, MatAllocator* allocator) {
+	for (int scale = 1; scale < scales; scale++)
+		if (pyramid[scale].empty()) downsample(pyramid[scale - 1], pyramid[scale], allocator);
+}
+
+// Where the planes of a comparison come from
+static MatAllocator* allocatorOf(const Options& options) {
+	return options.workspace ? options.workspace->allocator() : nullptr;
+}
+
+// An RGB (or opaque) original compared against an RGBA image with some transparency gets an opaque alpha plane, like
+// the images themselves would.
+static void addOpaqueAlpha(Planes* img, Planes* mu, int scales, Blur blur, MatAllocator* allocator) {
+	Planes alpha[6], blurred[6];
+	for (int scale = 0; scale < scales; scale++) {
+		const Mat& L = img[scale][0];
+		alpha[scale].resize(1);
+		allocate(alpha[scale][0], L.size(), L.type(), allocator);
+		alpha[scale][0].setTo(Scalar(1.0));
+	}
+	blurScales(alpha, scales, blur, blurred, allocator);
+	for (int scale = 0; scale < scales; scale++) {
+		img[scale].push_back(alpha[scale][0]);
+		mu[scale].push_back(blurred[scale][0]);
+	}
+}
+
+// What an alpha channel that is the same in both images contributes: its SSIM map is 1 everywhere (x and y are the same,
+// so the numerator and denominator are too) and it has no artifact edges, exactly
+static PlaneStats identicalPlane() {
+	PlaneStats plane;
+	plane.mean = plane.min = plane.edgeMean = 1;
+	plane.identical = true;
+	return plane;
+}
+
+// Whether a distorted image can be scored against ref
+static Status check(const Reference& ref, const Mat& distorted) {
+	if (ref.nChan == 0 || distorted.empty()) return Status::InvalidArgument;
+	if (!supported(distorted)) return Status::Unsupported;
+	if (distorted.size() != ref.size) return Status::SizeMismatch;
+
+	const unsigned int img2_temp_channels = distorted.channels();
+	if (img2_temp_channels != ref.nChan && (ref.nChan < 3 || img2_temp_channels < 3)) return Status::ChannelMismatch;
+	return Status::Ok;
+}
+
+// Planes of distorted as scored against ref: an alpha channel the same in both images has none
+static unsigned int distortedPlanes(const Reference& ref, const Mat& distorted) {
+	const unsigned int channels = max(ref.nChan, (unsigned int)distorted.channels());
+	return channels == 4 && sameAlpha(ref.alpha, distorted) ? 3 : channels;
+}
+
+// Reference::create, and for compare() the full-resolution planes of the distorted image along with it, when distorted is
+// not null: both images are converted and halved in the same pass (see ingest()), into pyramid[0] and pyramid[1]
+static Status createReference(Reference& ref, const Mat& original, const Options& opts, ChannelOrder order,
+	const Mat* distorted, ChannelOrder distortedOrder, Planes* pyramid) {
+	if (original.empty()) return Status::InvalidArgument;
+	if (!supported(original)) return Status::Unsupported;
+	if (original.cols < 8 || original.rows < 8) return Status::TooSmall;
+
+	try {
+		// an opaque alpha channel is left out of the pyramid, see score(); any other is kept to compare against
+		ref.alpha.release();
+		if (original.channels() == 4 && !sameAlpha(original, Mat())) extractChannel(original, ref.alpha, 3);
+		const unsigned int refPlanes = original.channels() == 4 && ref.alpha.empty() ? 3 : original.channels();
+
+		ref.options = opts;
+		ref.size = original.size();
+		ref.nChan = original.channels();
+		if (distorted) {
+			const Status status = check(ref, *distorted);
+			if (status != Status::Ok) return status;
+		}
+
+		MatAllocator* const allocator = allocatorOf(opts);
+		ref.scales = scaleCount(ref.size);
+		for (Planes& scale : ref.img) scale.clear();
+		Conversion images[2] = { { &original, order, refPlanes, &ref.img[0], ref.scales > 1 ? &ref.img[1] : nullptr } };
+		int count = 1;
+		if (distorted)
+			images[count++] = { distorted, distortedOrder, distortedPlanes(ref, *distorted), &pyramid[0], ref.scales > 1 ? &pyramid[1] : nullptr };
+		ingest(images, count, opts.precision, allocator);
+		downscale(ref.img, ref.scales, allocator);
+
+		allocate(ref.pixels, ref.size, original.type(), allocator);
+		original.copyTo(ref.pixels);
+		ref.order = order;
+		// a and b start at 1:2; only the scale below needed them at full resolution
+		if (opts.subsampledChroma && refPlanes >= 3) ref.img[0][1] = ref.img[0][2] = Mat();
+		blurScales(ref.img, ref.scales, opts.blur, ref.mu, allocator);
+	}
+	catch (const bad_alloc&) { return Status::OutOfMemory; }
+	catch (const exception&) { return Status::InternalError; }
+	return Status::Ok;
+}
+
+Status Reference::create(const Mat& original, const Options& opts, ChannelOrder order) {
+	return createReference(*this, original, opts, order, nullptr, order, nullptr);
+}
+
+// Add what one scale contributes to the score; the artifact edges and grid artifacts only count at full resolution
+template <unsigned int nChan>
+static void addScale(const ScaleStats& stats, int scale, Size size, bool subsampledChroma, double& score) {
+	// asymmetric: penalty for introducing edges where there are none (e.g. blockiness), no penalty for smoothing away edges
+	if (scale == 0) {
+		for (unsigned int i = 0; i < nChan; i++)
+			if (scored(nChan, i, scale, subsampledChroma)) score += extra_edges_weight[i] * stats.plane[i].edgeMean;
+		grid_artifacts<nChan>(stats, size, subsampledChroma, score, 1);
+		grid_artifacts<nChan>(stats, size, subsampledChroma, score, 0);
+	}
+
+	// average ssim over the entire image
+	for (unsigned int i = 0; i < nChan; i++)
+		if (scored(nChan, i, scale, subsampledChroma))
+			score += (i > 0 ? chroma_weight : 1.0) * stats.plane[i].mean * scale_weights[i][scale];
+
+	// worst ssim in a particular 4x4 block (larger blocks are considered too because of multi-scale)
+	for (unsigned int i = 0; i < nChan; i++)
+		if (scored(nChan, i, scale, subsampledChroma)) score += min_weight[i] * stats.plane[i].min * mscale_weights[i][scale];
+}
+
+// The sum of the weights of every term addScale adds over the given number of scales, in the same order, so it is the
+// very same double as summing them along with the score
+template <unsigned int nChan>
+constexpr double scoreMax(int scales, bool subsampledChroma) {
+	double score_max = 0;
+	for (int scale = 0; scale < scales; scale++) {
+		if (scale == 0) {
+			for (unsigned int i = 0; i < nChan; i++)
+				if (scored(nChan, i, scale, subsampledChroma)) score_max += extra_edges_weight[i];
+			for (int twice = 1; twice >= 0; twice--)
+				for (int line = 0; line < 2; line++)
+					for (unsigned int i = 0; i < nChan; i++)
+						if (scored(nChan, i, scale, subsampledChroma)) score_max += worst_grid_weight[twice][i];
+		}
+		for (unsigned int i = 0; i < nChan; i++)
+			if (scored(nChan, i, scale, subsampledChroma)) score_max += (i > 0 ? chroma_weight : 1.0) * scale_weights[i][scale];
+		for (unsigned int i = 0; i < nChan; i++)
+			if (scored(nChan, i, scale, subsampledChroma)) score_max += min_weight[i] * mscale_weights[i][scale];
+	}
+	return score_max;
+}
+
+// scoreMax for every number of scales, without and with subsampled chroma, worked out by the compiler
+template <unsigned int nChan>
+struct ScoreMaxTable {
+	double value[2][7];
+
+	constexpr ScoreMaxTable() : value() {
+		for (int chroma = 0; chroma < 2; chroma++)
+			for (int scales = 0; scales <= 6; scales++) value[chroma][scales] = scoreMax<nChan>(scales, chroma == 1);
+	}
+};
+
+static double finalScore(double score, double score_max) {
+	score = score_max / score - 1;
+	if (score < 0) score = 0; // should not happen
+	if (score > 1) score = 1; // very different images
+
+	return score;
+}
+
+template <unsigned int nChan>
+static double finalScore(const ScaleStats* stats, int scales, Size size, bool subsampledChroma) {
+	static constexpr ScoreMaxTable<nChan> score_max;
+	double score = 0;
+	for (int scale = 0; scale < scales; scale++) addScale<nChan>(stats[scale], scale, size, subsampledChroma, score);
+	return finalScore(score, score_max.value[subsampledChroma][scales]);
+}
+
+// The score of an image with nChan channels from the stats of its scales; size is that of scale 0
+static double finalScore(const ScaleStats* stats, int scales, Size size, unsigned int nChan, bool subsampledChroma) {
+	switch (nChan) {
+	case 1: return finalScore<1>(stats, scales, size, subsampledChroma);
+	case 3: return finalScore<3>(stats, scales, size, subsampledChroma);
+	default: return finalScore<4>(stats, scales, size, subsampledChroma);
+	}
+}
+
+// Turn the 8-bit maps into the heatmap images: artifact edges of L in yellow and of chroma in blue, and the SSIM of
+// every channel inverted so that bad areas are bright; alpha, if any, opaque
+template <int cn>
+static void colorHeatmaps(Mat& edgediff, Mat& ssim) {
+	typedef Vec<uchar, cn> Pixel;
+	for (int y = 0; y < edgediff.rows; y++) {
+		Pixel* e = edgediff.ptr<Pixel>(y);
+		Pixel* s = ssim.ptr<Pixel>(y);
+		for (int x = 0; x < edgediff.cols; x++) {
+			const Pixel p = e[x], q = s[x];
+			e[x][0] = (uchar)(p[1] + p[2]);
+			e[x][1] = e[x][2] = p[0];
+			s[x][0] = (uchar)(255 - q[2]);
+			s[x][1] = (uchar)(255 - q[0]);
+			s[x][2] = (uchar)(255 - q[1]);
+			if (cn == 4) e[x][cn - 1] = s[x][cn - 1] = 255;
+		}
+	}
+}
+
+// Whether two images have the same pixels, in the same channel order
+static bool sameImage(const Mat& img1, ChannelOrder order1, const Mat& img2, ChannelOrder order2) {
+	if (img1.type() != img2.type() || img1.size() != img2.size() || (img1.channels() > 1 && order1 != order2)) return false;
+	const size_t rowBytes = (size_t)img1.cols * img1.elemSize();
+	for (int y = 0; y < img1.rows; y++)
+		if (memcmp(img1.ptr(y), img2.ptr(y), rowBytes) != 0) return false;
+	return true;
+}
+
+// Planes the original skips at full resolution (subsampled chroma) are only needed for the scale below
+static void dropSkipped(const Planes& img1, Planes& img2) {
+	for (size_t c = 0; c < img2.size(); c++)
+		if (img1[c].empty()) img2[c] = Mat();
+}
+
+// img1 and mu1 are the pyramid of the original and its blur, and pyramid the Lab version of the distorted image, with as
+// many planes, as far down as it goes (at least scale 0); channels past those (an alpha channel the same in both images)
+// only count as identical
+static double computeScore(const Planes* img1, const Planes* mu1, int scales, unsigned int nChan, bool subsampledChroma,
+	Blur blur, MatAllocator* allocator, Planes* pyramid, Heatmaps* heatmaps) {
+	const Planes img2 = pyramid[0];
+	const unsigned int planes = (unsigned int)img2.size();
+
+	// the only dependency between scales is the downscaling, so build the pyramid first and score all scales at once
+	downscale(pyramid, scales, allocator);
+	dropSkipped(img1[0], pyramid[0]);
+
+	// Standard SSIM computation, plus the artifact edges at full resolution; the maps themselves are only needed for the heatmaps
+	const bool maps = heatmaps && nChan > 2;
+	Planes ssim_planes, edgediff_planes;
+	ScaleStats stats[6];
+	scoreScales(img1, mu1, pyramid, scales, blur, stats, maps ? &ssim_planes : nullptr, maps ? &edgediff_planes : nullptr);
+	for (int scale = 0; scale < scales; scale++)
+		for (unsigned int c = planes; c < nChan; c++) stats[scale].plane[c] = identicalPlane();
+
+	// optional: nice debug images that show the artifact edges and the problematic areas
+	if (maps) {
+		for (unsigned int c = planes; c < nChan; c++) {
+			ssim_planes.push_back(Mat(img2[0].size(), img2[0].type(), Scalar(1.0)));
+			edgediff_planes.push_back(Mat(img2[0].size(), img2[0].type(), Scalar(0.0)));
+		}
+		Mat ssim_map, edgediff;
+		merge(ssim_planes, ssim_map);
+		merge(edgediff_planes, edgediff);
+
+		edgediff.convertTo(heatmaps->edgediff, CV_8UC3, 5000); // multiplying by more than 255 to make things easier to see
+		ssim_map.convertTo(heatmaps->ssim, CV_8UC3, 255);
+		if (nChan == 4) colorHeatmaps<4>(heatmaps->edgediff, heatmaps->ssim);
+		else colorHeatmaps<3>(heatmaps->edgediff, heatmaps->ssim);
+	}
+
+	return finalScore(stats, scales, img1[0][0].size(), nChan, subsampledChroma);
+}
+
+// The pyramid of ref and its blur as scored against distorted, in img1 and mu1; returns the number of planes scored.
+// An RGB image compared against an RGBA original is read as opaque RGBA, and the other way around. When both have the
+// same alpha (most often, none), the alpha channel is not scored at all but counted as identical.
+static unsigned int referencePlanes(const Reference& ref, const Mat& distorted, Planes* img1, Planes* mu1) {
+	const unsigned int planes = distortedPlanes(ref, distorted);
+
+	for (int scale = 0; scale < ref.scales; scale++) {
+		img1[scale].assign(ref.img[scale].begin(), ref.img[scale].begin() + min(planes, (unsigned int)ref.img[scale].size()));
+		mu1[scale].assign(ref.mu[scale].begin(), ref.mu[scale].begin() + min(planes, (unsigned int)ref.mu[scale].size()));
+	}
+	if (img1[0].size() < planes) addOpaqueAlpha(img1, mu1, ref.scales, ref.options.blur, allocatorOf(ref.options));
+	return planes;
+}
+
+// The score of distorted against ref, from the top of its pyramid (see computeScore)
+static double scorePyramid(const Reference& ref, const Mat& distorted, Planes* pyramid, Heatmaps* heatmaps) {
+	const unsigned int channels = max(ref.nChan, (unsigned int)distorted.channels());
+	Planes img1[6], mu1[6];
+	referencePlanes(ref, distorted, img1, mu1);
+	return computeScore(img1, mu1, ref.scales, channels, ref.options.subsampledChroma, ref.options.blur, allocatorOf(ref.options),
+		pyramid, heatmaps);
+}
+
+Status Reference::score(const Mat& distorted, double& score, Heatmaps* heatmaps, ChannelOrder order) const {
+	const Status status = check(*this, distorted);
+	if (status != Status::Ok) return status;
+	// the same image as the original, e.g. a lossless re-encode: every term is exactly 1, so the score is exactly 0
+	if (!heatmaps && sameImage(pixels, this->order, distorted, order)) {
+		score = 0;
+		return Status::Ok;
+	}
+
+	try {
+		Planes pyramid[6];
+		const Conversion image = { &distorted, order, distortedPlanes(*this, distorted), &pyramid[0], scales > 1 ? &pyramid[1] : nullptr };
+		ingest(&image, 1, options.precision, allocatorOf(options));
+		score = scorePyramid(*this, distorted, pyramid, heatmaps);
+	}
+	catch (const bad_alloc&) { return Status::OutOfMemory; }
+	catch (const exception&) { return Status::InternalError; }
+	return Status::Ok;
+}
+
+// compare() under a memory limit: both images stream through all scales at once; see stream.cpp
+static Status streamCompare(const Mat& original, ChannelOrder originalOrder, const Mat& distorted, ChannelOrder distortedOrder,
+	const Options& options, double& score) {
+	if (original.empty() || distorted.empty()) return Status::InvalidArgument;
+	if (!supported(original) || !supported(distorted)) return Status::Unsupported;
+	if (original.cols < 8 || original.rows < 8) return Status::TooSmall;
+	if (distorted.size() != original.size()) return Status::SizeMismatch;
+
+	// an RGB image compared against an RGBA image is read as opaque RGBA, whichever of the two it is
+	unsigned int nChan = original.channels(), img2_temp_channels = distorted.channels();
+	if (img2_temp_channels != nChan && (nChan < 3 || img2_temp_channels < 3)) return Status::ChannelMismatch;
+	nChan = max(nChan, img2_temp_channels);
+
+	try {
+		// an alpha channel the same in both images is only counted, as in Reference::score
+		const unsigned int planes = nChan == 4 && sameAlpha(original, distorted) ? 3 : nChan;
+
+		ScaleStats stats[6];
+		const int depth = options.precision == Precision::Float ? CV_32F : CV_64F;
+		int scales = streamScales(original.size(), depth, planes, options.subsampledChroma, options.blur,
+			[&](int begin, int end, Planes& dst) { ingest(original, originalOrder, planes, begin, end, dst, options.precision); },
+			[&](int begin, int end, Planes& dst) { ingest(distorted, distortedOrder, planes, begin, end, dst, options.precision); },
+			options.maxMemory, allocatorOf(options), stats);
+		if (scales == 0) return Status::OutOfMemory;
+		for (int scale = 0; scale < scales; scale++)
+			for (unsigned int c = planes; c < nChan; c++) stats[scale].plane[c] = identicalPlane();
+
+		score = finalScore(stats, scales, original.size(), nChan, options.subsampledChroma);
+	}
+	catch (const bad_alloc&) { return Status::OutOfMemory; }
+	catch (const exception&) { return Status::InternalError; }
+	return Status::Ok;
+}
+
+Status compare(const Mat& original, const Mat& distorted, double& score, Heatmaps* heatmaps, const Options& options,
+	ChannelOrder originalOrder, ChannelOrder distortedOrder) {
+	// the same pixels (e.g. a lossless re-encode) score exactly 0; see Reference::score
+	if (!heatmaps && supported(original) && original.cols >= 8 && original.rows >= 8 &&
+		sameImage(original, originalOrder, distorted, distortedOrder)) {
+		score = 0;
+		return Status::Ok;
+	}
+	if (options.maxMemory) {
+		// the heatmaps are as large as the images
+		if (heatmaps) return Status::InvalidArgument;
+		return streamCompare(original, originalOrder, distorted, distortedOrder, options, score);
+	}
+
+	// Reference::create and Reference::score, with both images converted in one pass
+	Reference ref;
+	Planes pyramid[6];
+	const Status status = createReference(ref, original, options, originalOrder, &distorted, distortedOrder, pyramid);
+	if (status != Status::Ok) return status;
+	try {
+		score = scorePyramid(ref, distorted, pyramid, heatmaps);
+	}
+	catch (const bad_alloc&) { return Status::OutOfMemory; }
+	catch (const exception&) { return Status::InternalError; }
+	return Status::Ok;
+}
+
+struct Incremental::State {
+	const Reference* ref;
+	ChannelOrder order;
+	int type;                       // of the distorted image
+	unsigned int channels, planes;  // as in Reference::score
+	Planes img1[6], mu1[6];         // the original as scored against this image
+	Planes img2[6];                 // the whole pyramid of the distorted image, full-resolution chroma included
+	vector<TileResult> tiles;       // what every tile contributes, see scoreScales
+	ScaleStats stats[6];
+	double score;
+};
+
+// Redo the pixels of dst, one scale below src, that depend on the pixels of rect in src, and return where they are
+template <typename T>
+static Rect downscaleRect(const Planes& src, Rect rect, Planes& dst) {
+	const int x0 = rect.x / 2, x1 = min((rect.x + rect.width + 1) / 2, dst[0].cols);
+	const int y0 = rect.y / 2, y1 = min((rect.y + rect.height + 1) / 2, dst[0].rows);
+	for (size_t c = 0; c < src.size(); c++)
+		for (int y = y0; y < y1; y++) {
+			const bool pair = 2 * y + 1 < src[c].rows;
+			downsampleRow(src[c].ptr<T>(2 * y), pair ? src[c].ptr<T>(2 * y + 1) : nullptr, src[c].cols, x0, x1, dst[c].ptr<T>(y));
+		}
+	return Rect(x0, y0, max(x1 - x0, 0), max(y1 - y0, 0));
+}
+
+Status Incremental::start(const Reference& reference, const Mat& distorted, double& score, ChannelOrder order) {
+	state.reset();
+	const Status status = check(reference, distorted);
+	if (status != Status::Ok) return status;
+
+	try {
+		shared_ptr<State> st = make_shared<State>();
+		st->ref = &reference;
+		st->order = order;
+		st->type = distorted.type();
+		st->channels = max(reference.nChan, (unsigned int)distorted.channels());
+		st->planes = referencePlanes(reference, distorted, st->img1, st->mu1);
+
+		const Conversion image = { &distorted, order, st->planes, &st->img2[0], reference.scales > 1 ? &st->img2[1] : nullptr };
+		ingest(&image, 1, reference.options.precision, allocatorOf(reference.options));
+		downscale(st->img2, reference.scales, allocatorOf(reference.options));
+		Planes img2[6];
+		copy(st->img2, st->img2 + reference.scales, img2);
+		dropSkipped(st->img1[0], img2[0]);
+
+		scoreScales(st->img1, st->mu1, img2, reference.scales, reference.options.blur, st->stats, nullptr, nullptr, &st->tiles);
+		for (int scale = 0; scale < reference.scales; scale++)
+			for (unsigned int c = st->planes; c < st->channels; c++) st->stats[scale].plane[c] = identicalPlane();
+		st->score = finalScore(st->stats, reference.scales, reference.size, st->channels, reference.options.subsampledChroma);
+		score = st->score;
+		state = st;
+	}
+	catch (const bad_alloc&) { return Status::OutOfMemory; }
+	catch (const exception&) { return Status::InternalError; }
+	return Status::Ok;
+}
+
+Status Incremental::update(const Mat& distorted, Rect dirty, double& score) {
+	if (!state || distorted.type() != state->type) return Status::InvalidArgument;
+	State& st = *state;
+	const Reference& ref = *st.ref;
+	if (distorted.size() != ref.size) return Status::SizeMismatch;
+
+	dirty &= Rect(Point(), ref.size);
+	if (dirty.empty()) {
+		score = st.score;
+		return Status::Ok;
+	}
+
+	try {
+		// an alpha channel that was the same in both images and no longer is has to be scored from now on: start over
+		if (st.planes < st.channels && !sameAlpha(ref.alpha.empty() ? Mat() : ref.alpha(dirty), distorted(dirty)))
+			return start(ref, distorted, score, st.order);
+
+		Planes roi;
+		for (const Mat& plane : st.img2[0]) roi.push_back(plane(dirty));
+		ingest(distorted(dirty), st.order, st.planes, 0, dirty.height, roi, ref.options.precision);
+
+		Rect changed[6] = { dirty };
+		for (int scale = 1; scale < ref.scales; scale++)
+			changed[scale] = ref.options.precision == Precision::Float ?
+				downscaleRect<float>(st.img2[scale - 1], changed[scale - 1], st.img2[scale]) :
+				downscaleRect<double>(st.img2[scale - 1], changed[scale - 1], st.img2[scale]);
+		Planes img2[6];
+		copy(st.img2, st.img2 + ref.scales, img2);
+		dropSkipped(st.img1[0], img2[0]);
+
+		rescoreScales(st.img1, st.mu1, img2, ref.scales, ref.options.blur, changed, st.tiles, st.stats);
+		st.score = finalScore(st.stats, ref.scales, ref.size, st.channels, ref.options.subsampledChroma);
+		score = st.score;
+	}
+	catch (const bad_alloc&) { state.reset(); return Status::OutOfMemory; }
+	catch (const exception&) { state.reset(); return Status::InternalError; }
+	return Status::Ok;
+}
+
+}
@@ -0,0 +1,419 @@
+/*
+	Scoring the scales: the SSIM and edge difference maps, and their reductions.
+
+	Licensed under the Apache License, Version 2.0; see libssimx.cpp for the full notice.
+
+	Every channel is a plane of its own. A plane is split into tiles whose sides are multiples of
+	the 4x4 blocks. Each tile blurs its moments into its own buffers (reading 5 pixel halos from
+	the full planes), computes the SSIM value of every pixel (and at scale 0 the edge difference)
+	and reduces them right away: the sums of each of its rows and columns, and the lowest 4x4 block
+	average. The blocks follow resize(0.25, INTER_AREA) exactly, including its rounded output size
+	and the partial blocks on the right and bottom edges.
+
+	Tiles where both images are the same, halo included, are not computed at all: their SSIM is
+	exactly 1 and their edge difference exactly 0.
+
+	Tiles of every plane run on the OpenCV thread pool together. Their partial results are merged
+	in tile order once all of them are done, so scores are bit identical for any number of threads.
+
+	All scales of a pyramid are scored together, their tiles mixed in one parallel loop. A scale
+	can also be scored a band of tile rows at a time, from planes that only hold the rows
+	the band needs (see stream.cpp). Row sums of a band go straight to their place and column sums
+	keep adding up band after band, so the merge order, and the score, stay the same.
+*/
+
+#include "kernels.h"
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <float.h>
+#include <string.h>
+#include <vector>
+
+using namespace std;
+using namespace cv;
+
+namespace ssimx {
+
+static const int BLOCK = 4, TILE_WIDTH = 128, TILE_HEIGHT = TILE_ROWS;
+
+// The arithmetic of the original multiply/addWeighted/pow sequence, in the same order
+template <typename T>
+static void ssimRow(const T* mu1, const T* mu2, const T* sigma12, const T* sigma_sq, int n, T* out) {
+	for (int i = 0; i < n; i++) {
+		T mu1_mu2 = mu1[i] * mu2[i] * 2;
+		T num = (mu1_mu2 + (T)C1) * (sigma12[i] * 2 + mu1_mu2 * -1 + (T)C2);
+		T mu_sq = mu1[i] * mu1[i] + mu2[i] * mu2[i];
+		T den = (mu_sq + (T)C1) * (sigma_sq[i] * 1 + mu_sq * -1 + (T)C2);
+		out[i] = num / den;
+	}
+}
+
+// Sum one row of a map into rowSum (per channel) and, when given, colSum (per element)
+template <typename T>
+static void addLines(const T* row, int cols, int cn, double* rowSum, double* colSum) {
+	for (int c = 0; c < cn; c++) rowSum[c] = 0;
+	for (int x = 0; x < cols; x++)
+		for (int c = 0; c < cn; c++) rowSum[c] += row[x * cn + c];
+	if (colSum)
+		for (int i = 0; i < cols * cn; i++) colSum[i] += row[i];
+}
+
+// Whether two planes are the same over a tile and the 5 pixels around it that its blur reads
+template <typename T>
+static bool sameRegion(const Mat& x, const Mat& y, Rect tile) {
+	const Rect r = Rect(tile.x - 5, tile.y - 5, tile.width + 10, tile.height + 10) & Rect(0, 0, x.cols, x.rows);
+	for (int v = r.y; v < r.y + r.height; v++)
+		if (memcmp(x.ptr<T>(v) + r.x, y.ptr<T>(v) + r.x, r.width * sizeof(T)) != 0) return false;
+	return true;
+}
+
+// tile is in the rows of the planes, which start at row top of a scale of the given size
+template <typename T>
+static void scoreTile(const Mat& img1, const Mat& mu1, const Mat& img2, int top, Size size, bool edges, Blur blur, Rect tile,
+	TileResult& result, Mat* ssim, Mat* edgediff) {
+	const int n = tile.width;
+	// resize(0.25, INTER_AREA) output size; only rows and columns of whole blocks use the fast path
+	const int bw = cvRound(size.width * 0.25), bh = cvRound(size.height * 0.25), fullCols = size.width / BLOCK;
+
+	// Where both images are the same, so are their blurs, and sigma_sq is exactly twice sigma12: every SSIM value is
+	// exactly 1 and every edge difference 0, and so are their sums and block averages. mu1 was blurred on blurScales'
+	// tiles and mu2 would be on this one, so this relies on every blur giving each output the same bits whatever the
+	// tiling (see blur.cpp); a blur that depends on the tiling has to give up the shortcut.
+	if (sameRegion<T>(img1, img2, tile)) {
+		result.rows.assign(tile.height, (double)n);
+		result.cols.assign(edges ? n : 0, (double)tile.height);
+		result.edgeRows.assign(edges ? tile.height : 0, (double)n);
+		result.edgeCols.assign(edges ? n : 0, (double)tile.height);
+		result.min = (top + tile.y) / BLOCK < bh && tile.x / BLOCK < bw ? 1.0 : DBL_MAX;
+		for (int y = tile.y; y < tile.y + tile.height; y++) {
+			if (ssim) fill(ssim->ptr<T>(y) + tile.x, ssim->ptr<T>(y) + tile.x + n, (T)1);
+			if (edgediff) fill(edgediff->ptr<T>(y) + tile.x, edgediff->ptr<T>(y) + tile.x + n, (T)0);
+		}
+		return;
+	}
+
+	// mu2, sigma12 before subtracting mu1*mu2, and sigma1_sq + sigma2_sq before subtracting mu1^2 + mu2^2;
+	// mu1 as well when it isn't given
+	const Moment moments[4] = { Moment::Y, Moment::XY, Moment::XXYY, Moment::X };
+	const int count = mu1.empty() ? 4 : 3;
+	const size_t plane = (size_t)tile.height * n;
+	vector<T> blurred(count * plane);
+	T* const mu2 = &blurred[0];
+	T* const sigma12 = &blurred[plane];
+	T* const sigma_sq = &blurred[2 * plane];
+	T* const out[4] = { mu2, sigma12, sigma_sq, count == 4 ? &blurred[3 * plane] : nullptr };
+	blurTile<T>(img1, img2, moments, count, blur, tile, out, n);
+
+	result.rows.assign(tile.height, 0.0);
+	result.cols.assign(edges ? n : 0, 0.0);
+	result.edgeRows.assign(edges ? tile.height : 0, 0.0);
+	result.edgeCols.assign(edges ? n : 0, 0.0);
+	result.min = DBL_MAX;
+
+	vector<T> values(ssim ? 0 : (size_t)BLOCK * n), edge(edges ? n : 0);
+	const T* r[BLOCK];
+	for (int y0 = 0; y0 < tile.height; y0 += BLOCK) {
+		const int height = min(BLOCK, tile.height - y0);
+
+		for (int j = 0; j < height; j++) {
+			const int y = tile.y + y0 + j;
+			const size_t o = (size_t)(y0 + j) * n;
+			const T* m1 = count == 4 ? out[3] + o : mu1.ptr<T>(y) + tile.x;
+			T* v = ssim ? ssim->ptr<T>(y) + tile.x : &values[(size_t)j * n];
+			ssimRow(m1, mu2 + o, sigma12 + o, sigma_sq + o, n, v);
+			addLines(v, n, 1, &result.rows[y0 + j], edges ? result.cols.data() : nullptr);
+			r[j] = v;
+
+			if (!edges) continue;
+			const T* x = img1.ptr<T>(y) + tile.x;
+			const T* w = img2.ptr<T>(y) + tile.x;
+			T* e = edgediff ? edgediff->ptr<T>(y) + tile.x : nullptr;
+			for (int i = 0; i < n; i++) {
+				// positive if img2 has an edge where img1 is smooth
+				T d = max(abs(w[i] - mu2[o + i]) - abs(x[i] - m1[i]), (T)0);
+				if (e) e[i] = d;
+				edge[i] = 1 - d;
+			}
+			addLines(edge.data(), n, 1, &result.edgeRows[y0 + j], result.edgeCols.data());
+		}
+
+		if ((top + tile.y + y0) / BLOCK >= bh) continue;
+		const int full = height == BLOCK ? fullCols : 0;
+		const int end = min(bw, (tile.x + tile.width + BLOCK - 1) / BLOCK);
+		for (int bx = tile.x / BLOCK; bx < end; bx++) {
+			const int x0 = bx * BLOCK - tile.x;
+			T s = 0, avg;
+			if (bx < full) {
+				for (int j = 0; j < BLOCK; j++)
+					for (int k = 0; k < BLOCK; k++) s += r[j][x0 + k];
+				avg = (T)(s * (1.f / (BLOCK * BLOCK)));
+			}
+			else {
+				int count = 0;
+				for (int j = 0; j < height; j++)
+					for (int k = 0; k < BLOCK && x0 + k < tile.width; k++) { s += r[j][x0 + k]; count++; }
+				avg = (T)((float)s / count);
+			}
+			result.min = min(result.min, (double)avg);
+		}
+	}
+}
+
+// Add the line sums of a band of tiles starting at row y0 to lines, in tile order: the rows of the tile rows and the
+// columns of the tile columns in the tiles rectangle (of tile indices)
+static void mergeLines(const TileResult* results, int tilesX, int tilesY, int y0, Rect tiles,
+	vector<double> TileResult::* tileRows, vector<double> TileResult::* tileCols, LineSums& lines) {
+	for (int ty = tiles.y; ty < tiles.y + tiles.height; ty++)
+		for (int tx = 0; tx < tilesX; tx++) {
+			const vector<double>& r = results[(size_t)ty * tilesX + tx].*tileRows;
+			double* dst = &lines.rows[(size_t)y0 + ty * TILE_HEIGHT];
+			for (size_t i = 0; i < r.size(); i++) dst[i] += r[i];
+		}
+	if (tileCols)
+		for (int tx = tiles.x; tx < tiles.x + tiles.width; tx++)
+			for (int ty = 0; ty < tilesY; ty++) {
+				const vector<double>& c = results[(size_t)ty * tilesX + tx].*tileCols;
+				double* dst = &lines.cols[(size_t)tx * TILE_WIDTH];
+				for (size_t i = 0; i < c.size(); i++) dst[i] += c[i];
+			}
+}
+
+// Mean of a whole plane from its row sums
+static double lineMean(const LineSums& lines, Size size) {
+	double sum = 0;
+	for (int y = 0; y < size.height; y++) sum += lines.rows[y];
+	return sum / ((double)size.height * size.width);
+}
+
+// The tiles of rows [y0, y1) of a plane, in merge order
+struct TileBand {
+	Size size;
+	int y0, y1, tilesX, tilesY;
+
+	TileBand(Size size, int y0, int y1) : size(size), y0(y0), y1(y1) {
+		tilesX = (size.width + TILE_WIDTH - 1) / TILE_WIDTH;
+		tilesY = (y1 - y0 + TILE_HEIGHT - 1) / TILE_HEIGHT;
+	}
+	int count() const { return tilesX * tilesY; }
+	Rect tile(int i) const {
+		Rect tile((i % tilesX) * TILE_WIDTH, y0 + (i / tilesX) * TILE_HEIGHT, 0, 0);
+		tile.width = min(TILE_WIDTH, size.width - tile.x);
+		tile.height = min(TILE_HEIGHT, y1 - tile.y);
+		return tile;
+	}
+};
+
+// Add the results of the tiles of a band to the stats of a plane; the first band starts them, the last one computes the means
+static void mergeBand(const TileBand& band, const TileResult* results, bool edges, PlaneStats& stats) {
+	if (band.y0 == 0) {
+		stats.ssimLines.rows.assign(band.size.height, 0.0);
+		stats.ssimLines.cols.assign(edges ? band.size.width : 0, 0.0);
+		stats.edgeLines.rows.assign(edges ? band.size.height : 0, 0.0);
+		stats.edgeLines.cols.assign(edges ? band.size.width : 0, 0.0);
+		stats.min = DBL_MAX;
+	}
+
+	const Rect all(0, 0, band.tilesX, band.tilesY);
+	mergeLines(results, band.tilesX, band.tilesY, band.y0, all, &TileResult::rows, edges ? &TileResult::cols : nullptr, stats.ssimLines);
+	if (edges) mergeLines(results, band.tilesX, band.tilesY, band.y0, all, &TileResult::edgeRows, &TileResult::edgeCols, stats.edgeLines);
+	for (int i = 0; i < band.count(); i++) stats.min = min(stats.min, results[i].min);
+
+	if (band.y1 < band.size.height) return;
+	stats.mean = lineMean(stats.ssimLines, band.size);
+	if (edges) stats.edgeMean = lineMean(stats.edgeLines, band.size);
+}
+
+// Merge a whole-scale band again after the tiles in the tiles rectangle (of tile indices) changed: the line sums those
+// tiles are part of start over and add up in the same order as in mergeBand, so they come out the same as a full merge.
+// Only the min and the means look at every tile or line.
+static void remergeBand(const TileBand& band, const TileResult* results, bool edges, Rect tiles, PlaneStats& stats) {
+	const int y0 = tiles.y * TILE_HEIGHT, y1 = min((tiles.y + tiles.height) * TILE_HEIGHT, band.size.height);
+	const int x0 = tiles.x * TILE_WIDTH, x1 = min((tiles.x + tiles.width) * TILE_WIDTH, band.size.width);
+	for (LineSums* lines : { &stats.ssimLines, &stats.edgeLines }) {
+		if (!lines->rows.empty()) fill(lines->rows.begin() + y0, lines->rows.begin() + y1, 0.0);
+		if (!lines->cols.empty()) fill(lines->cols.begin() + x0, lines->cols.begin() + x1, 0.0);
+	}
+	mergeLines(results, band.tilesX, band.tilesY, 0, tiles, &TileResult::rows, edges ? &TileResult::cols : nullptr, stats.ssimLines);
+	if (edges) mergeLines(results, band.tilesX, band.tilesY, 0, tiles, &TileResult::edgeRows, &TileResult::edgeCols, stats.edgeLines);
+
+	stats.min = DBL_MAX;
+	for (int i = 0; i < band.count(); i++) stats.min = min(stats.min, results[i].min);
+	stats.mean = lineMean(stats.ssimLines, band.size);
+	if (edges) stats.edgeMean = lineMean(stats.edgeLines, band.size);
+}
+
+template <typename T>
+static void scoreRows(const Planes& img1, const Planes& mu1, const Planes& img2, int top, Size size, int y0, int y1, bool edges,
+	Blur blur, ScaleStats& stats, Planes* ssim, Planes* edgediff) {
+	const TileBand band(size, y0, y1);
+	const int planes = (int)img1.size(), tiles = band.count();
+	vector<TileResult> results((size_t)planes * tiles);
+	parallel_for_(Range(0, planes * tiles), [&](const Range& range) {
+		for (int i = range.start; i < range.end; i++) {
+			const int c = i / tiles;
+			if (img1[c].empty()) continue;
+			Rect tile = band.tile(i % tiles);
+			tile.y -= top;
+			scoreTile<T>(img1[c], mu1.empty() ? Mat() : mu1[c], img2[c], top, size, edges, blur, tile, results[i],
+				ssim ? &(*ssim)[c] : nullptr, edgediff ? &(*edgediff)[c] : nullptr);
+		}
+	});
+	for (int c = 0; c < planes; c++)
+		if (!img1[c].empty()) mergeBand(band, &results[(size_t)c * tiles], edges, stats.plane[c]);
+}
+
+void scoreRows(const Planes& img1, const Planes& mu1, const Planes& img2, int top, Size size, int y0, int y1, bool edges,
+	Blur blur, ScaleStats& stats, Planes* ssim, Planes* edgediff) {
+	CV_Assert(!img1.empty() && img1.size() <= 4 && img2.size() == img1.size() && (mu1.empty() || mu1.size() == img1.size()));
+	CV_Assert(img1[0].channels() == 1 && img1[0].size() == img2[0].size() && img1[0].type() == img2[0].type() && img1[0].cols == size.width);
+	CV_Assert(y0 % TILE_ROWS == 0 && top <= max(y0 - 5, 0) && top + img1[0].rows >= min(y1 + 5, size.height));
+	if (img1[0].depth() == CV_32F) scoreRows<float>(img1, mu1, img2, top, size, y0, y1, edges, blur, stats, ssim, edgediff);
+	else scoreRows<double>(img1, mu1, img2, top, size, y0, y1, edges, blur, stats, ssim, edgediff);
+}
+
+// The whole-scale bands of a pyramid, and where the tiles of each scale start in the results of all of them
+static void pyramidTiles(const Planes* img1, int scales, vector<TileBand>& bands, vector<int>& first) {
+	const int planes = (int)img1[0].size();
+	first.assign(1, 0);
+	for (int s = 0; s < scales; s++) {
+		bands.push_back(TileBand(img1[s][0].size(), 0, img1[s][0].rows));
+		first.push_back(first.back() + planes * bands.back().count());
+	}
+}
+
+// The scales only depend on each other through the pyramids, so once those are built, the tiles of every plane of
+// every scale are independent tasks; small images, with few tiles per plane, still keep all threads busy.
+template <typename T>
+static void scoreScales(const Planes* img1, const Planes* mu1, const Planes* img2, int scales, Blur blur, ScaleStats* stats,
+	Planes* ssim, Planes* edgediff, vector<TileResult>* tiles) {
+	const int planes = (int)img1[0].size();
+	vector<TileBand> bands;
+	vector<int> first;
+	pyramidTiles(img1, scales, bands, first);
+	vector<TileResult> results(first.back());
+
+	parallel_for_(Range(0, first.back()), [&](const Range& range) {
+		for (int i = range.start; i < range.end; i++) {
+			const int s = (int)(upper_bound(first.begin(), first.end(), i) - first.begin()) - 1;
+			const int tiles = bands[s].count(), c = (i - first[s]) / tiles;
+			if (img1[s][c].empty()) continue;
+			scoreTile<T>(img1[s][c], mu1[s][c], img2[s][c], 0, bands[s].size, s == 0, blur, bands[s].tile((i - first[s]) % tiles),
+				results[i], s == 0 && ssim ? &(*ssim)[c] : nullptr, s == 0 && edgediff ? &(*edgediff)[c] : nullptr);
+		}
+	});
+	for (int s = 0; s < scales; s++)
+		for (int c = 0; c < planes; c++)
+			if (!img1[s][c].empty()) mergeBand(bands[s], &results[first[s] + (size_t)c * bands[s].count()], s == 0, stats[s].plane[c]);
+	if (tiles) tiles->swap(results);
+}
+
+void scoreScales(const Planes* img1, const Planes* mu1, const Planes* img2, int scales, Blur blur, ScaleStats* stats,
+	Planes* ssim, Planes* edgediff, vector<TileResult>* tiles) {
+	CV_Assert(scales > 0 && scales <= 6 && !img1[0].empty() && img1[0].size() <= 4);
+	for (int s = 0; s < scales; s++) CV_Assert(img1[s].size() == img2[s].size() && mu1[s].size() == img1[s].size());
+	const Mat& first = img1[0][0];
+	for (Planes* maps : { ssim, edgediff })
+		if (maps) {
+			maps->resize(img1[0].size());
+			for (size_t c = 0; c < maps->size(); c++)
+				if (img1[0][c].empty()) (*maps)[c] = Mat(first.size(), first.type(), Scalar(maps == ssim ? 1.0 : 0.0));
+				else (*maps)[c].create(first.size(), first.type());
+		}
+	if (first.depth() == CV_32F) scoreScales<float>(img1, mu1, img2, scales, blur, stats, ssim, edgediff, tiles);
+	else scoreScales<double>(img1, mu1, img2, scales, blur, stats, ssim, edgediff, tiles);
+}
+
+template <typename T>
+static void rescoreScales(const Planes* img1, const Planes* mu1, const Planes* img2, int scales, Blur blur, const Rect* dirty,
+	vector<TileResult>& results, ScaleStats* stats) {
+	const int planes = (int)img1[0].size();
+	vector<TileBand> bands;
+	vector<int> first;
+	pyramidTiles(img1, scales, bands, first);
+	CV_Assert(results.size() == (size_t)first.back());
+
+	// the tiles whose blur reads a changed pixel: those within 5 pixels of the change
+	vector<Rect> redo(scales);
+	vector<int> todo;
+	for (int s = 0; s < scales; s++) {
+		const TileBand& band = bands[s];
+		const Rect r = Rect(dirty[s].x - 5, dirty[s].y - 5, dirty[s].width + 10, dirty[s].height + 10) & Rect(Point(), band.size);
+		if (dirty[s].empty() || r.empty()) continue;
+		redo[s] = Rect(r.x / TILE_WIDTH, r.y / TILE_HEIGHT, 0, 0);
+		redo[s].width = (r.x + r.width - 1) / TILE_WIDTH + 1 - redo[s].x;
+		redo[s].height = (r.y + r.height - 1) / TILE_HEIGHT + 1 - redo[s].y;
+		for (int c = 0; c < planes; c++) {
+			if (img1[s][c].empty()) continue;
+			for (int ty = redo[s].y; ty < redo[s].y + redo[s].height; ty++)
+				for (int tx = redo[s].x; tx < redo[s].x + redo[s].width; tx++)
+					todo.push_back(first[s] + c * band.count() + ty * band.tilesX + tx);
+		}
+	}
+
+	parallel_for_(Range(0, (int)todo.size()), [&](const Range& range) {
+		for (int k = range.start; k < range.end; k++) {
+			const int i = todo[k];
+			const int s = (int)(upper_bound(first.begin(), first.end(), i) - first.begin()) - 1;
+			const int tiles = bands[s].count(), c = (i - first[s]) / tiles;
+			scoreTile<T>(img1[s][c], mu1[s][c], img2[s][c], 0, bands[s].size, s == 0, blur, bands[s].tile((i - first[s]) % tiles),
+				results[i], nullptr, nullptr);
+		}
+	});
+	for (int s = 0; s < scales; s++) {
+		if (redo[s].empty()) continue;
+		for (int c = 0; c < planes; c++)
+			if (!img1[s][c].empty())
+				remergeBand(bands[s], &results[first[s] + (size_t)c * bands[s].count()], s == 0, redo[s], stats[s].plane[c]);
+	}
+}
+
+void rescoreScales(const Planes* img1, const Planes* mu1, const Planes* img2, int scales, Blur blur, const Rect* dirty,
+	vector<TileResult>& tiles, ScaleStats* stats) {
+	CV_Assert(scales > 0 && scales <= 6 && !img1[0].empty() && img1[0].size() <= 4);
+	for (int s = 0; s < scales; s++) CV_Assert(img1[s].size() == img2[s].size() && mu1[s].size() == img1[s].size());
+	if (img1[0][0].depth() == CV_32F) rescoreScales<float>(img1, mu1, img2, scales, blur, dirty, tiles, stats);
+	else rescoreScales<double>(img1, mu1, img2, scales, blur, dirty, tiles, stats);
+}
+
+size_t scoreRowsMemory(int width, int rows, int planes, int depth, bool edges, Blur blur) {
+	const size_t elem = depth == CV_32F ? sizeof(float) : sizeof(double);
+	const size_t tiles = (size_t)((width + TILE_WIDTH - 1) / TILE_WIDTH) * ((rows + TILE_HEIGHT - 1) / TILE_HEIGHT);
+	// line sums of every tile, and on every thread the blurred moments of a tile and the rings that blur them (or,
+	// approximately blurred, the whole padded tile)
+	size_t results = tiles * planes * (TILE_HEIGHT + TILE_WIDTH) * sizeof(double) * (edges ? 2 : 1);
+	const size_t blurRows = blur == Blur::Gaussian ? 11 : TILE_HEIGHT + 10;
+	size_t scratch = (4 * (size_t)TILE_HEIGHT + 4 * blurRows + 2 * BLOCK) * (TILE_WIDTH + 10) * elem;
+	return results + getNumThreads() * scratch;
+}
+
+template <typename T>
+static void lineSums(const Mat& map, LineSums& lines) {
+	const int cn = map.channels();
+	lines.rows.resize((size_t)map.rows * cn);
+	lines.cols.assign((size_t)map.cols * cn, 0.0);
+	for (int y = 0; y < map.rows; y++) addLines(map.ptr<T>(y), map.cols, cn, &lines.rows[(size_t)y * cn], lines.cols.data());
+}
+
+void lineSums(const Mat& map, LineSums& lines) {
+	CV_Assert(map.channels() <= 4);
+	if (map.depth() == CV_32F) lineSums<float>(map, lines);
+	else lineSums<double>(map, lines);
+}
+
+void worstLines(const LineSums& lines, int width, int height, int cn, double* worstRow, double* worstCol) {
+	vector<double> v;
+	for (int c = 0; c < cn; c++) {
+		v.resize(height);
+		for (int y = 0; y < height; y++) v[y] = lines.rows[(size_t)y * cn + c] / width;
+		nth_element(v.begin(), v.begin() + height / 50, v.end());
+		worstRow[c] = v[height / 50];
+
+		v.resize(width);
+		for (int x = 0; x < width; x++) v[x] = lines.cols[(size_t)x * cn + c] / height;
+		nth_element(v.begin(), v.begin() + width / 50, v.end());
+		worstCol[c] = v[width / 50];
+	}
+}
+
+}
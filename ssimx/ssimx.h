@@ -0,0 +1,160 @@
+/*
+	libssimx - the SSIM-X (SSIMULACRA) metric as a reentrant library.
+
+	Licensed under the Apache License, Version 2.0; see libssimx.cpp for the full notice.
+
+	Nothing in here prints, exits or keeps global state: every call reports problems through
+	its Status return value, so one bad image never takes the rest of a batch down with it.
+	All functions may be called concurrently; a Reference may be shared between threads.
+
+	Images are 8-bit or 16-bit grayscale, BGR or BGRA cv::Mats (OpenCV channel order), as returned
+	by the decode functions below (see ChannelOrder for RGB input); 16-bit values span the full
+	0..65535 range. Scores are between 0 (identical) and 1 (very different).
+*/
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ssimx {
+
+// Keep in sync with ssimx_status in ssimx_c.h
+enum class Status {
+	Ok = 0,
+	ReadError,          // the file could not be opened or read
+	DecodeError,        // the data is not an image in a format we can decode
+	Unsupported,        // decoded, but not 8-bit or 16-bit Grayscale, RGB or RGBA
+	TooSmall,           // fewer than 8 rows or columns
+	SizeMismatch,       // original and distorted image dimensions differ
+	ChannelMismatch,    // e.g. grayscale compared against RGB
+	InvalidArgument,
+	OutOfMemory,
+	InternalError,
+};
+
+const char* statusString(Status status);
+
+// Decode an image file; AVIF is recognized by its .avif extension, everything else goes to imread.
+Status decodeFile(const std::string& filename, cv::Mat& img);
+
+// Decode an encoded image held in memory; AVIF is recognized by its ftyp box.
+Status decodeMemory(const void* data, size_t size, cv::Mat& img);
+
+// Element type of every plane in the pipeline. Float halves memory traffic and doubles SIMD width;
+// scores typically differ from the Double path by less than 1e-5 (largest seen: 1.1e-5, on a 9x8 image).
+enum class Precision {
+	Double,
+	Float,
+};
+
+// How the 11x11, sigma 1.5 Gaussian windows of SSIM are computed. The approximation is for screening large batches:
+// its scores follow the exact ones closely but are not the same (see the README), so don't mix them.
+enum class Blur {
+	Gaussian,   // exact
+	Box,        // three box filters of width 3 along each axis, as running sums down the columns
+};
+
+// Channel order of 3 and 4 channel images. The decoders produce BGR(A); RGB(A) pixels from elsewhere
+// can be passed as they are, without a conversion pass.
+enum class ChannelOrder {
+	BGR,
+	RGB,
+};
+
+// Keeps the planes of comparisons (the converted images, their pyramids and blurs) once they are freed, and hands them
+// out again to the next comparison that needs a plane of the same size, instead of going back to the system allocator:
+// in a batch of images of one size, only the first comparison allocates them. Set Options::workspace to use one.
+// Buffers are 64-byte aligned; with hugePages, large ones are backed by huge pages where the system offers them
+// (transparent huge pages on Linux). A Workspace may be shared between threads and has to outlive every Reference and
+// Incremental created with it. Free buffers are kept up to maxFree bytes (0: twice the most bytes ever in use at once,
+// which a comparison of the largest images so far needed); past that, the least recently freed ones are released, so
+// images of changing sizes don't pile up buffers of every size. trim() releases all free buffers.
+class Workspace {
+public:
+	explicit Workspace(bool hugePages = false, size_t maxFree = 0);
+	~Workspace();
+	Workspace(const Workspace&) = delete;
+	Workspace& operator=(const Workspace&) = delete;
+
+	size_t requests() const;     // buffers asked for: allocations there would have been without a workspace
+	size_t allocations() const;  // of those, the ones the pool could not hand out again
+	size_t bytes() const;        // held, in use or free, with the rounding of huge pages
+	void trim();                 // free the buffers not in use
+
+	cv::MatAllocator* allocator() const;
+
+private:
+	struct Pool;
+	std::unique_ptr<Pool> pool;
+};
+
+struct Options {
+	Precision precision = Precision::Double;
+
+	// Upper bound in bytes on the working memory of compare(); 0 means none. Under a limit, the images stream through
+	// the pipeline in bands of rows instead of being converted whole, with the same score; the decoded images
+	// themselves are not counted. Heatmaps are not available then, and a limit too small for even one band of rows
+	// gives OutOfMemory. A Reference always holds its whole pyramid and ignores this.
+	size_t maxMemory = 0;
+
+	// Score the a and b channels from the 1:2 scale on, like subsampled chroma: at full resolution, where they weigh
+	// least, they are neither blurred nor scored and have no artifact-edge or grid terms. That is two thirds of the
+	// full-resolution work on RGB images; scores differ a little (see the README).
+	bool subsampledChroma = false;
+
+	Blur blur = Blur::Gaussian;
+
+	// Where the planes come from; null for the OpenCV allocator
+	Workspace* workspace = nullptr;
+};
+
+// Visualizations of the full-resolution artifact-edge and SSIM maps (RGB and RGBA images only).
+struct Heatmaps {
+	cv::Mat edgediff, ssim;
+};
+
+// Everything that only depends on the original image: a copy of it, its Lab pyramid and, at every scale,
+// the blurred image (mu1). Create it once to score many distorted images against the same original.
+// Every scale is kept as one single-channel plane per channel: L, a, b and alpha (or just gray). A fully opaque alpha
+// channel has no plane; an alpha channel is only scored when the distorted image has a different one.
+struct Reference {
+	Options options;
+	cv::Size size;
+	unsigned int nChan = 0;     // channels of the original
+	int scales = 0;
+	std::vector<cv::Mat> img[6], mu[6];
+	cv::Mat alpha;              // alpha of an RGBA original, unless it is opaque
+	cv::Mat pixels;             // the original itself, in order, to recognize an identical image before any work
+	ChannelOrder order = ChannelOrder::BGR;
+
+	Status create(const cv::Mat& original, const Options& options = Options(), ChannelOrder order = ChannelOrder::BGR);
+
+	// heatmaps is optional; when given, the debug images are returned in it
+	Status score(const cv::Mat& distorted, double& score, Heatmaps* heatmaps = nullptr, ChannelOrder order = ChannelOrder::BGR) const;
+};
+
+// Scores a distorted image against a Reference, then again every time a rectangle of it changed (an editor, an encoder
+// tuning one region), at a cost that grows with the size of the change rather than of the image: the pyramid of the
+// distorted image and what every tile of it contributes are kept, and only the pixels and tiles the change reaches are
+// redone. Scores are the same as Reference::score. The Reference must outlive it and stay unchanged. No heatmaps; one
+// Incremental is not for use from several threads at once.
+class Incremental {
+public:
+	Status start(const Reference& reference, const cv::Mat& distorted, double& score, ChannelOrder order = ChannelOrder::BGR);
+
+	// distorted is the whole image, of the same type as at start, and changed only inside dirty since the last call
+	Status update(const cv::Mat& distorted, cv::Rect dirty, double& score);
+
+private:
+	struct State;
+	std::shared_ptr<State> state;
+};
+
+// One-off comparison; equivalent to Reference::create followed by Reference::score, unless options.maxMemory is set.
+Status compare(const cv::Mat& original, const cv::Mat& distorted, double& score, Heatmaps* heatmaps = nullptr,
+	const Options& options = Options(), ChannelOrder originalOrder = ChannelOrder::BGR, ChannelOrder distortedOrder = ChannelOrder::BGR);
+
+}
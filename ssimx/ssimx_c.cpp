@@ -0,0 +1,180 @@
+/*
+	libssimx C ABI.
+
+	Licensed under the Apache License, Version 2.0; see libssimx.cpp for the full notice.
+*/
+
+#include "ssimx_c.h"
+#include "ssimx.h"
+
+#include <opencv2/opencv.hpp>
+#include <new>
+#include <stddef.h>
+#include <string.h>
+
+using namespace std;
+using namespace cv;
+
+static_assert((int)ssimx::Status::InternalError == SSIMX_ERROR_INTERNAL, "ssimx_status is out of sync with ssimx::Status");
+
+struct ssimx_reference {
+	ssimx::Reference ref;
+};
+
+struct ssimx_workspace {
+	ssimx::Workspace workspace;
+	explicit ssimx_workspace(bool hugePages) : workspace(hugePages) {}
+};
+
+// Wraps the caller's pixels without taking ownership or converting them
+static ssimx::Status toMat(const ssimx_image* image, Mat& img, ssimx::ChannelOrder& order) {
+	if (!image || !image->pixels || image->width <= 0 || image->height <= 0) return ssimx::Status::InvalidArgument;
+
+	int channels;
+	switch (image->format) {
+	case SSIMX_PIXEL_GRAY: channels = 1; break;
+	case SSIMX_PIXEL_RGB: case SSIMX_PIXEL_BGR: channels = 3; break;
+	case SSIMX_PIXEL_RGBA: case SSIMX_PIXEL_BGRA: channels = 4; break;
+	default: return ssimx::Status::InvalidArgument;
+	}
+	size_t stride = image->stride ? image->stride : (size_t)image->width * channels;
+	if (stride < (size_t)image->width * channels) return ssimx::Status::InvalidArgument;
+
+	img = Mat(image->height, image->width, CV_8UC(channels), (void*)image->pixels, stride);
+	order = image->format == SSIMX_PIXEL_RGB || image->format == SSIMX_PIXEL_RGBA ? ssimx::ChannelOrder::RGB : ssimx::ChannelOrder::BGR;
+	return ssimx::Status::Ok;
+}
+
+static ssimx_status toC(ssimx::Status status) {
+	return (ssimx_status)status;
+}
+
+// Only look at the fields the caller's version of ssimx_options has
+#define HAS_FIELD(options, field) ((options)->struct_size >= offsetof(ssimx_options, field) + sizeof((options)->field))
+
+static ssimx::Status toOptions(const ssimx_options* options, ssimx::Options& opts) {
+	if (!options) return ssimx::Status::Ok;
+	if (HAS_FIELD(options, precision)) {
+		if (options->precision != SSIMX_PRECISION_DOUBLE && options->precision != SSIMX_PRECISION_FLOAT) return ssimx::Status::InvalidArgument;
+		opts.precision = options->precision == SSIMX_PRECISION_FLOAT ? ssimx::Precision::Float : ssimx::Precision::Double;
+	}
+	if (HAS_FIELD(options, max_memory)) opts.maxMemory = options->max_memory;
+	if (HAS_FIELD(options, subsampled_chroma)) opts.subsampledChroma = options->subsampled_chroma != 0;
+	if (HAS_FIELD(options, blur)) {
+		switch (options->blur) {
+		case SSIMX_BLUR_GAUSSIAN: opts.blur = ssimx::Blur::Gaussian; break;
+		case SSIMX_BLUR_BOX: opts.blur = ssimx::Blur::Box; break;
+		default: return ssimx::Status::InvalidArgument;
+		}
+	}
+	if (HAS_FIELD(options, workspace) && options->workspace) opts.workspace = &options->workspace->workspace;
+	return ssimx::Status::Ok;
+}
+
+void ssimx_options_init(ssimx_options* options) {
+	if (!options) return;
+	memset(options, 0, sizeof(*options));
+	options->struct_size = sizeof(*options);
+	options->precision = SSIMX_PRECISION_DOUBLE;
+}
+
+const char* ssimx_status_string(ssimx_status status) {
+	return ssimx::statusString((ssimx::Status)status);
+}
+
+ssimx_status ssimx_compare(const ssimx_image* original, const ssimx_image* distorted, const ssimx_options* options, double* score) {
+	if (!score) return SSIMX_ERROR_INVALID_ARGUMENT;
+	Mat img1, img2;
+	ssimx::ChannelOrder order1, order2;
+	ssimx::Options opts;
+	ssimx::Status status = toOptions(options, opts);
+	if (status == ssimx::Status::Ok) status = toMat(original, img1, order1);
+	if (status == ssimx::Status::Ok) status = toMat(distorted, img2, order2);
+	if (status == ssimx::Status::Ok) status = ssimx::compare(img1, img2, *score, NULL, opts, order1, order2);
+	return toC(status);
+}
+
+ssimx_status ssimx_compare_encoded(const void* original, size_t original_size, const void* distorted, size_t distorted_size,
+	const ssimx_options* options, double* score) {
+	if (!score) return SSIMX_ERROR_INVALID_ARGUMENT;
+	Mat img1, img2;
+	ssimx::Options opts;
+	ssimx::Status status = toOptions(options, opts);
+	if (status == ssimx::Status::Ok) status = ssimx::decodeMemory(original, original_size, img1);
+	if (status == ssimx::Status::Ok) status = ssimx::decodeMemory(distorted, distorted_size, img2);
+	if (status == ssimx::Status::Ok) status = ssimx::compare(img1, img2, *score, NULL, opts);
+	return toC(status);
+}
+
+static ssimx_status createReference(const Mat& img, ssimx::ChannelOrder order, const ssimx_options* options, ssimx_reference** reference) {
+	ssimx::Options opts;
+	ssimx::Status status = toOptions(options, opts);
+	if (status != ssimx::Status::Ok) return toC(status);
+	ssimx_reference* r = new (nothrow) ssimx_reference;
+	if (!r) return SSIMX_ERROR_OUT_OF_MEMORY;
+	status = r->ref.create(img, opts, order);
+	if (status != ssimx::Status::Ok) {
+		delete r;
+		return toC(status);
+	}
+	*reference = r;
+	return SSIMX_OK;
+}
+
+ssimx_status ssimx_reference_create(const ssimx_image* original, const ssimx_options* options, ssimx_reference** reference) {
+	if (!reference) return SSIMX_ERROR_INVALID_ARGUMENT;
+	*reference = NULL;
+	Mat img;
+	ssimx::ChannelOrder order;
+	ssimx::Status status = toMat(original, img, order);
+	if (status != ssimx::Status::Ok) return toC(status);
+	return createReference(img, order, options, reference);
+}
+
+ssimx_status ssimx_reference_create_encoded(const void* original, size_t original_size, const ssimx_options* options, ssimx_reference** reference) {
+	if (!reference) return SSIMX_ERROR_INVALID_ARGUMENT;
+	*reference = NULL;
+	Mat img;
+	ssimx::Status status = ssimx::decodeMemory(original, original_size, img);
+	if (status != ssimx::Status::Ok) return toC(status);
+	return createReference(img, ssimx::ChannelOrder::BGR, options, reference);
+}
+
+ssimx_status ssimx_reference_score(const ssimx_reference* reference, const ssimx_image* distorted, double* score) {
+	if (!reference || !score) return SSIMX_ERROR_INVALID_ARGUMENT;
+	Mat img;
+	ssimx::ChannelOrder order;
+	ssimx::Status status = toMat(distorted, img, order);
+	if (status == ssimx::Status::Ok) status = reference->ref.score(img, *score, NULL, order);
+	return toC(status);
+}
+
+ssimx_status ssimx_reference_score_encoded(const ssimx_reference* reference, const void* distorted, size_t distorted_size, double* score) {
+	if (!reference || !score) return SSIMX_ERROR_INVALID_ARGUMENT;
+	Mat img;
+	ssimx::Status status = ssimx::decodeMemory(distorted, distorted_size, img);
+	if (status == ssimx::Status::Ok) status = reference->ref.score(img, *score);
+	return toC(status);
+}
+
+void ssimx_reference_free(ssimx_reference* reference) {
+	delete reference;
+}
+
+ssimx_status ssimx_workspace_create(int huge_pages, ssimx_workspace** workspace) {
+	if (!workspace) return SSIMX_ERROR_INVALID_ARGUMENT;
+	*workspace = NULL;
+	try { *workspace = new ssimx_workspace(huge_pages != 0); }
+	catch (const bad_alloc&) { return SSIMX_ERROR_OUT_OF_MEMORY; }
+	return SSIMX_OK;
+}
+
+void ssimx_workspace_stats(const ssimx_workspace* workspace, size_t* requests, size_t* allocations) {
+	if (!workspace) return;
+	if (requests) *requests = workspace->workspace.requests();
+	if (allocations) *allocations = workspace->workspace.allocations();
+}
+
+void ssimx_workspace_free(ssimx_workspace* workspace) {
+	delete workspace;
+}
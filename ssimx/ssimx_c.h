@@ -0,0 +1,125 @@
+/*
+	libssimx C ABI, for calling the metric in-process from other languages.
+
+	Licensed under the Apache License, Version 2.0; see libssimx.cpp for the full notice.
+
+	All functions return an ssimx_status and never abort the process. A reference may be
+	used from several threads at once; it has to be released with ssimx_reference_free.
+*/
+
+#ifndef SSIMX_C_H
+#define SSIMX_C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32) && defined(SSIMX_SHARED)
+#  ifdef SSIMX_EXPORTS
+#    define SSIMX_API __declspec(dllexport)
+#  else
+#    define SSIMX_API __declspec(dllimport)
+#  endif
+#elif defined(__GNUC__)
+#  define SSIMX_API __attribute__((visibility("default")))
+#else
+#  define SSIMX_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum ssimx_status {
+	SSIMX_OK = 0,
+	SSIMX_ERROR_READ,
+	SSIMX_ERROR_DECODE,
+	SSIMX_ERROR_UNSUPPORTED,
+	SSIMX_ERROR_TOO_SMALL,
+	SSIMX_ERROR_SIZE_MISMATCH,
+	SSIMX_ERROR_CHANNEL_MISMATCH,
+	SSIMX_ERROR_INVALID_ARGUMENT,
+	SSIMX_ERROR_OUT_OF_MEMORY,
+	SSIMX_ERROR_INTERNAL,
+} ssimx_status;
+
+typedef enum ssimx_pixel_format {
+	SSIMX_PIXEL_GRAY = 0,
+	SSIMX_PIXEL_RGB,
+	SSIMX_PIXEL_RGBA,
+	SSIMX_PIXEL_BGR,
+	SSIMX_PIXEL_BGRA,
+} ssimx_pixel_format;
+
+// An 8-bit interleaved image in caller-owned memory; stride is in bytes (0 means tightly packed).
+typedef struct ssimx_image {
+	int width;
+	int height;
+	ssimx_pixel_format format;
+	size_t stride;
+	const uint8_t* pixels;
+} ssimx_image;
+
+typedef enum ssimx_precision {
+	SSIMX_PRECISION_DOUBLE = 0,
+	SSIMX_PRECISION_FLOAT,
+} ssimx_precision;
+
+// See ssimx::Blur
+typedef enum ssimx_blur {
+	SSIMX_BLUR_GAUSSIAN = 0,
+	SSIMX_BLUR_BOX,
+} ssimx_blur;
+
+// See ssimx::Workspace; may be shared between threads
+typedef struct ssimx_workspace ssimx_workspace;
+
+// Fill with ssimx_options_init before changing fields; the library only reads the first
+// struct_size bytes, so callers built against an older header keep working.
+typedef struct ssimx_options {
+	size_t struct_size;
+	ssimx_precision precision;
+	// Upper bound in bytes on the working memory of ssimx_compare and ssimx_compare_encoded (0: none);
+	// the images then stream through in bands of rows. References ignore it.
+	size_t max_memory;
+	// Nonzero: score the chroma channels from the 1:2 scale on only; faster, with slightly different scores.
+	int subsampled_chroma;
+	// Approximate the Gaussian windows, for screening; scores are close to the exact ones but not the same.
+	ssimx_blur blur;
+	// Reuse plane buffers across calls (NULL: none); it has to outlive the references created with it.
+	ssimx_workspace* workspace;
+} ssimx_options;
+
+typedef struct ssimx_reference ssimx_reference;
+
+SSIMX_API const char* ssimx_status_string(ssimx_status status);
+
+SSIMX_API void ssimx_options_init(ssimx_options* options);
+
+// One-off comparisons. The score is between 0 (identical) and 1 (very different).
+// options may be NULL for the defaults.
+SSIMX_API ssimx_status ssimx_compare(const ssimx_image* original, const ssimx_image* distorted,
+	const ssimx_options* options, double* score);
+SSIMX_API ssimx_status ssimx_compare_encoded(const void* original, size_t original_size,
+	const void* distorted, size_t distorted_size, const ssimx_options* options, double* score);
+
+// Precompute the original once, then score many distorted images against it.
+SSIMX_API ssimx_status ssimx_reference_create(const ssimx_image* original, const ssimx_options* options,
+	ssimx_reference** reference);
+SSIMX_API ssimx_status ssimx_reference_create_encoded(const void* original, size_t original_size,
+	const ssimx_options* options, ssimx_reference** reference);
+SSIMX_API ssimx_status ssimx_reference_score(const ssimx_reference* reference, const ssimx_image* distorted, double* score);
+SSIMX_API ssimx_status ssimx_reference_score_encoded(const ssimx_reference* reference,
+	const void* distorted, size_t distorted_size, double* score);
+SSIMX_API void ssimx_reference_free(ssimx_reference* reference);
+
+// A pool of plane buffers for ssimx_options.workspace; huge_pages nonzero backs large ones with huge pages where possible.
+// requests and allocations (either may be NULL) receive the buffers asked for and those that had to be allocated.
+SSIMX_API ssimx_status ssimx_workspace_create(int huge_pages, ssimx_workspace** workspace);
+SSIMX_API void ssimx_workspace_stats(const ssimx_workspace* workspace, size_t* requests, size_t* allocations);
+SSIMX_API void ssimx_workspace_free(ssimx_workspace* workspace);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,147 @@
+/*
+	Scoring images too large to convert whole, in bounded memory.
+
+	Licensed under the Apache License, Version 2.0; see libssimx.cpp for the full notice.
+
+	Every scale only keeps a band of rows of both images: one band of tiles plus the 5 rows of blur
+	support above and below it. Rows of scale 0 are converted from the 8-bit inputs as the band has
+	room for them. Every pair of rows of a scale is averaged down, exactly like resize(0.5, INTER_AREA)
+	does it, and pushed into the band of the next scale as soon as both rows are there. A band is
+	scored as soon as all of its rows have arrived, then the rows nothing needs anymore are dropped.
+
+	The tiles, the blur and the merge order are the same as for whole scales, so the score is the
+	same as without a memory limit. The bands are as high as the limit allows, in whole tiles; the
+	decoded images are not counted.
+*/
+
+#include "kernels.h"
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <string.h>
+#include <vector>
+
+using namespace std;
+using namespace cv;
+
+namespace ssimx {
+
+static const int RADIUS = 5;
+
+struct Band {
+	Size size;              // of the whole scale
+	Planes img1, img2;      // rows [top, top + rows) of the scale, from the first row of the buffers
+	int top = 0, rows = 0;
+	int scored = 0;         // rows above this are done
+	int down = 0;           // next row of the scale below
+};
+
+// Rows [begin, end) of every plane
+static Planes rowsOf(const Planes& planes, int begin, int end) {
+	Planes rows;
+	for (const Mat& p : planes) rows.push_back(p.rowRange(begin, end));
+	return rows;
+}
+
+// Rows were added to band s: pass complete pairs down, score complete bands and drop what's no longer needed
+template <typename T>
+static void advance(vector<Band>& bands, size_t s, int bandRows, bool subsampledChroma, Blur blur, ScaleStats* stats) {
+	Band& b = bands[s];
+	const int end = b.top + b.rows;
+
+	// one row at a time, so the band below never has more rows than it can hold
+	if (s + 1 < bands.size()) {
+		Band& next = bands[s + 1];
+		while (b.down < next.size.height) {
+			const bool pair = 2 * b.down + 1 < b.size.height;
+			if (2 * b.down + (pair ? 1 : 0) >= end) break;
+			const int y = 2 * b.down - b.top;
+			for (size_t c = 0; c < b.img1.size(); c++) {
+				const Mat& x = b.img1[c];
+				const Mat& w = b.img2[c];
+				downsampleRow(x.ptr<T>(y), pair ? x.ptr<T>(y + 1) : nullptr, b.size.width, 0, next.size.width, next.img1[c].ptr<T>(next.rows));
+				downsampleRow(w.ptr<T>(y), pair ? w.ptr<T>(y + 1) : nullptr, b.size.width, 0, next.size.width, next.img2[c].ptr<T>(next.rows));
+			}
+			next.rows++;
+			b.down++;
+			advance<T>(bands, s + 1, bandRows, subsampledChroma, blur, stats);
+		}
+	}
+
+	while (b.scored < b.size.height) {
+		const int y1 = min(b.scored + bandRows, b.size.height);
+		if (end < min(y1 + RADIUS, b.size.height)) break;
+		Planes rows1 = rowsOf(b.img1, 0, b.rows), rows2 = rowsOf(b.img2, 0, b.rows);
+		if (s == 0 && subsampledChroma)
+			for (int c = 1; c < 3; c++) rows1[c] = rows2[c] = Mat();
+		scoreRows(rows1, Planes(), rows2, b.top, b.size, b.scored, y1, s == 0, blur, stats[s], nullptr, nullptr);
+		b.scored = y1;
+	}
+
+	int keep = b.scored - RADIUS;
+	if (s + 1 < bands.size()) keep = min(keep, 2 * b.down);
+	keep = min(max(keep, b.top), end);
+	if (keep == b.top) return;
+	const int dropped = keep - b.top;
+	const size_t rowBytes = (size_t)b.size.width * sizeof(T);
+	for (size_t c = 0; c < b.img1.size(); c++)
+		for (int y = dropped; y < b.rows; y++) {
+			memcpy(b.img1[c].ptr(y - dropped), b.img1[c].ptr(y), rowBytes);
+			memcpy(b.img2[c].ptr(y - dropped), b.img2[c].ptr(y), rowBytes);
+		}
+	b.top = keep;
+	b.rows -= dropped;
+}
+
+int streamScales(Size size, int depth, int planes, bool subsampledChroma, Blur blur, const RowSource& original,
+	const RowSource& distorted, size_t maxMemory, MatAllocator* allocator, ScaleStats* stats) {
+	subsampledChroma = subsampledChroma && planes >= 3;
+	const size_t elem = (depth == CV_32F ? sizeof(float) : sizeof(double)) * planes;
+
+	vector<Size> sizes;
+	for (Size s = size; sizes.size() < 6 && s.width >= 8 && s.height >= 8; s = Size(cvRound(s.width * 0.5), cvRound(s.height * 0.5)))
+		sizes.push_back(s);
+
+	// the highest band, in whole tiles, whose buffers and line sums at every scale fit in maxMemory;
+	// scales are scored one after the other, so only the largest scoring overhead counts
+	int bandRows = 0;
+	for (int rows = TILE_ROWS; ; rows += TILE_ROWS) {
+		size_t bytes = 0, scoring = 0;
+		for (size_t s = 0; s < sizes.size(); s++) {
+			bytes += 2 * (size_t)(rows + 2 * RADIUS) * sizes[s].width * elem;
+			bytes += (size_t)(sizes[s].width + sizes[s].height) * planes * sizeof(double) * (s == 0 ? 2 : 1);
+			scoring = max(scoring, scoreRowsMemory(sizes[s].width, rows, planes, depth, s == 0, blur));
+		}
+		if (bytes + scoring > maxMemory) break;
+		bandRows = rows;
+		if (rows >= size.height) break;
+	}
+	if (bandRows == 0) return 0;
+
+	const int capacity = bandRows + 2 * RADIUS;
+	vector<Band> bands(sizes.size());
+	for (size_t s = 0; s < sizes.size(); s++) {
+		bands[s].size = sizes[s];
+		bands[s].img1.resize(planes);
+		bands[s].img2.resize(planes);
+		for (int c = 0; c < planes; c++) {
+			allocate(bands[s].img1[c], Size(sizes[s].width, capacity), CV_MAKETYPE(depth, 1), allocator);
+			allocate(bands[s].img2[c], Size(sizes[s].width, capacity), CV_MAKETYPE(depth, 1), allocator);
+		}
+	}
+
+	Band& first = bands[0];
+	while (first.top + first.rows < size.height) {
+		const int begin = first.top + first.rows, end = min(begin + capacity - first.rows, size.height);
+		Planes rows1 = rowsOf(first.img1, first.rows, first.rows + end - begin);
+		Planes rows2 = rowsOf(first.img2, first.rows, first.rows + end - begin);
+		original(begin, end, rows1);
+		distorted(begin, end, rows2);
+		first.rows += end - begin;
+		if (depth == CV_32F) advance<float>(bands, 0, bandRows, subsampledChroma, blur, stats);
+		else advance<double>(bands, 0, bandRows, subsampledChroma, blur, stats);
+	}
+	return (int)sizes.size();
+}
+
+}
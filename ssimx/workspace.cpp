@@ -0,0 +1,209 @@
+/*
+	Pooled plane buffers, reused across scales and comparisons.
+
+	Licensed under the Apache License, Version 2.0; see libssimx.cpp for the full notice.
+
+	A Workspace is a cv::MatAllocator. The planes of a comparison (the converted images, their
+	pyramids and blurs, streaming bands) are created with it, and a buffer whose last Mat goes
+	away is kept in a free list keyed by its size in bytes instead of being freed. The next request
+	for exactly that size gets it back. Images of one size make the same requests every time, so
+	after the first comparison of a batch, the planes cost no allocation and no page faults.
+
+	The free list is bounded: by default to twice the most bytes ever in use at once, which is what
+	a comparison of the largest images so far needs. Buffers beyond it are freed, the least recently
+	freed first, so when the image size changes, the buffers of the old size make way for the new.
+
+	Buffers are 64-byte aligned. With huge pages, those of 2 MB and more are rounded up to whole
+	2 MB pages, aligned to them, and on Linux advised (MADV_HUGEPAGE) to be backed by transparent
+	huge pages; elsewhere the flag only changes the alignment.
+*/
+
+#include "kernels.h"
+
+#include <opencv2/opencv.hpp>
+#include <iterator>
+#include <list>
+#include <map>
+#include <mutex>
+#include <new>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+using namespace cv;
+
+namespace ssimx {
+
+static const size_t ALIGNMENT = 64, HUGE_PAGE = 2 << 20;
+
+static void* alignedMalloc(size_t size, size_t alignment) {
+#ifdef _WIN32
+	return _aligned_malloc(size, alignment);
+#else
+	void* p = nullptr;
+	return posix_memalign(&p, alignment, size) == 0 ? p : nullptr;
+#endif
+}
+
+static void alignedFree(void* p) {
+#ifdef _WIN32
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+struct Workspace::Pool : MatAllocator {
+	// a free buffer of size bytes
+	struct Free {
+		uchar* data;
+		size_t size;
+	};
+
+	bool hugePages;
+	size_t maxFree;
+	mutable mutex lock;
+	mutable list<Free> recent;                                // most recently freed first
+	mutable multimap<size_t, list<Free>::iterator> freed;    // the same, by size in bytes
+	mutable size_t requests = 0, allocations = 0;
+	mutable size_t bytes = 0, freeBytes = 0, peak = 0;       // capacities: held, free, most ever in use
+
+	Pool(bool huge, size_t maxFree) : hugePages(huge), maxFree(maxFree) {}
+
+	~Pool() {
+		for (auto& f : recent) alignedFree(f.data);
+	}
+
+	bool huge(size_t size) const {
+		return hugePages && size >= HUGE_PAGE;
+	}
+
+	// bytes actually allocated for a buffer of size bytes
+	size_t capacity(size_t size) const {
+		return huge(size) ? (size + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE : size;
+	}
+
+	uchar* take(size_t size) const {
+		{
+			lock_guard<mutex> guard(lock);
+			requests++;
+			auto f = freed.find(size);
+			if (f != freed.end()) {
+				uchar* p = f->second->data;
+				recent.erase(f->second);
+				freed.erase(f);
+				freeBytes -= capacity(size);
+				peak = max(peak, bytes - freeBytes);
+				return p;
+			}
+		}
+
+		const size_t held = capacity(size);
+		uchar* p = (uchar*)alignedMalloc(max(held, (size_t)1), huge(size) ? HUGE_PAGE : ALIGNMENT);
+		if (!p) throw bad_alloc();
+#ifdef __linux__
+		if (huge(size)) madvise(p, held, MADV_HUGEPAGE);
+#endif
+		lock_guard<mutex> guard(lock);
+		allocations++;
+		bytes += held;
+		peak = max(peak, bytes - freeBytes);
+		return p;
+	}
+
+	// Frees the least recently freed buffer; under the lock
+	void evict() const {
+		const Free& f = recent.back();
+		auto range = freed.equal_range(f.size);
+		for (auto i = range.first; i != range.second; i++)
+			if (i->second == prev(recent.end())) {
+				freed.erase(i);
+				break;
+			}
+		freeBytes -= capacity(f.size);
+		bytes -= capacity(f.size);
+		alignedFree(f.data);
+		recent.pop_back();
+	}
+
+	void give(uchar* p, size_t size) const {
+		lock_guard<mutex> guard(lock);
+		recent.push_front({ p, size });
+		freed.emplace(size, recent.begin());
+		freeBytes += capacity(size);
+		// a comparison can end with a little more free than it had in use at its peak: planes it freed before
+		// allocating others of other sizes, so leave room for those
+		const size_t limit = maxFree ? maxFree : 2 * peak;
+		while (freeBytes > limit && !recent.empty()) evict();
+	}
+
+	void trim() {
+		lock_guard<mutex> guard(lock);
+		while (!recent.empty()) evict();
+	}
+
+	// as StdMatAllocator does it, with the buffers from the pool
+	UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, AccessFlag, UMatUsageFlags) const override {
+		size_t total = CV_ELEM_SIZE(type);
+		for (int i = dims - 1; i >= 0; i--) {
+			if (step) {
+				if (data && step[i] != CV_AUTOSTEP) {
+					CV_Assert(total <= step[i]);
+					total = step[i];
+				}
+				else step[i] = total;
+			}
+			total *= sizes[i];
+		}
+		UMatData* u = new UMatData(this);
+		u->data = u->origdata = data ? (uchar*)data : take(total);
+		u->size = total;
+		if (data) u->flags |= UMatData::USER_ALLOCATED;
+		return u;
+	}
+
+	bool allocate(UMatData* u, AccessFlag, UMatUsageFlags) const override {
+		return u != nullptr;
+	}
+
+	void deallocate(UMatData* u) const override {
+		if (!u) return;
+		CV_Assert(u->urefcount == 0 && u->refcount == 0);
+		if (!(u->flags & UMatData::USER_ALLOCATED)) give(u->origdata, u->size);
+		delete u;
+	}
+};
+
+Workspace::Workspace(bool hugePages, size_t maxFree) : pool(new Pool(hugePages, maxFree)) {}
+
+Workspace::~Workspace() {}
+
+size_t Workspace::requests() const {
+	lock_guard<mutex> guard(pool->lock);
+	return pool->requests;
+}
+
+size_t Workspace::allocations() const {
+	lock_guard<mutex> guard(pool->lock);
+	return pool->allocations;
+}
+
+size_t Workspace::bytes() const {
+	lock_guard<mutex> guard(pool->lock);
+	return pool->bytes;
+}
+
+void Workspace::trim() {
+	pool->trim();
+}
+
+MatAllocator* Workspace::allocator() const {
+	return pool.get();
+}
+
+}